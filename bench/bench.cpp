@@ -0,0 +1,319 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    bench.cpp - microbenchmarks for the CPU cores, the bus and whole ROMs, JSON out
+*/
+
+// usage: bench [--out file.json] [--label text] [--iterations n] [--frames n] [rom ...]
+// every number is the best of a few repetitions, so background noise only ever makes things look slower
+//
+// - opcodes: ns per instruction for every implemented opcode, on both dispatch cores. the instruction sits
+//   in RAM and PC/SP are put back after every step, operands point into RAM so nothing touches I/O
+// - modes: the same, averaged per addressing mode
+// - bus: ns per read/write through the page table for each region (RAM mirrors, PPU registers, PRG RAM, PRG ROM)
+// - roms: emulated MHz running each ROM headless from its reset vector, NTSC is 1.79 MHz
+
+#include "../headers/emu/system.h"
+#include "../headers/emu/headless.h"
+#include "../headers/rom/rom.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+static const int REPETITIONS = 5;
+
+// where the benchmarked instruction lives, and what its operand bytes point at
+static const uint16_t CODE = 0x0300;
+static const uint8_t ZP = 0x10;
+static const uint16_t ABS = 0x0210;
+
+static const char* modeNames[] =
+{
+    "Accumulator", "Immediate", "ZeroPage", "ZeroPageX", "ZeroPageY", "Relative", "Absolute",
+    "AbsoluteX", "AbsoluteY", "Indirect", "IdxIndirect", "IndirectIdx", "Implicit"
+};
+
+// keeps the compiler from dropping reads nobody looks at
+static volatile uint32_t sink;
+
+// a JSON string, paths on windows are full of backslashes
+static std::string quoted(const char* text)
+{
+    std::string s = "\"";
+    for (const char* p = text; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            s += '\\';
+        s += *p;
+    }
+    return s + "\"";
+}
+
+static double seconds(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+// run fn repetitions times and keep the fastest, in ns per operation
+template <typename F>
+static double best(uint64_t operations, F fn)
+{
+    double fastest = 1e30;
+    for (int r = 0; r < REPETITIONS; r++)
+    {
+        auto start = clock_type::now();
+        fn();
+        double ns = seconds(start) * 1e9 / operations;
+        if (ns < fastest)
+            fastest = ns;
+    }
+    return fastest;
+}
+
+// a console with one instruction at CODE and pointers set up for every addressing mode
+static void setupOpcode(emu::Console& console, uint8_t op)
+{
+    memory::Bus& bus = console.bus;
+    std::fill(bus.internal.begin(), bus.internal.end(), 0x00);
+
+    bus.write(CODE, op);
+    bus.write(CODE + 1, ZP);
+    bus.write(CODE + 2, ABS >> 8);
+
+    // (zp), (zp,X) with X = 1 and JMP (abs) all land on ABS
+    bus.write(ZP, ABS & 0xFF);
+    bus.write(ZP + 1, ABS >> 8);
+    bus.write(ZP + 2, ABS >> 8);
+    bus.write(ABS, ABS & 0xFF);
+    bus.write(ABS + 1, ABS >> 8);
+
+    cpu::CPU& c = console.cpu;
+    c.A = 0x40;
+    c.X = 0x01;
+    c.Y = 0x01;
+    c.PS = 0x24;
+    c.SP = 0xFD;
+    c.PC = CODE;
+}
+
+static double timeOpcode(emu::Console& console, uint8_t op, uint8_t (*core)(cpu::CPU&), uint64_t iterations)
+{
+    setupOpcode(console, op);
+    cpu::CPU& c = console.cpu;
+
+    return best(iterations, [&]
+    {
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            core(c);
+            c.PC = CODE;
+            c.SP = 0xFD;
+        }
+    });
+}
+
+struct region
+{
+    const char* name;
+    uint16_t start;
+    uint16_t size;
+};
+
+static void benchBus(emu::Console& console, uint64_t iterations, FILE* out)
+{
+    static const region regions[] =
+    {
+        { "ram", 0x0000, 0x2000 }, // 2kb mirrored 4 times
+        { "ppu", 0x2000, 0x2000 }, // handlers, catches the PPU up on every access
+        { "prgRam", 0x6000, 0x2000 },
+        { "prg", 0x8000, 0x8000 },
+    };
+
+    memory::Bus& bus = console.bus;
+    fprintf(out, "  \"bus\": [\n");
+
+    for (size_t r = 0; r < sizeof(regions) / sizeof(regions[0]); r++)
+    {
+        const region& g = regions[r];
+        const uint16_t mask = g.size - 1;
+
+        double read = best(iterations, [&]
+        {
+            uint32_t sum = 0;
+            for (uint64_t i = 0; i < iterations; i++)
+                sum += bus.read(g.start + (i & mask));
+            sink = sum;
+        });
+
+        // PRG writes land in the mapper, so that one measures the cartridge's register writes
+        double write = best(iterations, [&]
+        {
+            for (uint64_t i = 0; i < iterations; i++)
+                bus.write(g.start + (i & mask), static_cast<uint8_t>(i));
+        });
+
+        fprintf(out, "    { \"region\": \"%s\", \"start\": \"0x%04X\", \"read_ns\": %.3f, \"write_ns\": %.3f }%s\n",
+            g.name, g.start, read, write, r + 1 < sizeof(regions) / sizeof(regions[0]) ? "," : "");
+    }
+
+    fprintf(out, "  ],\n");
+}
+
+static void benchRom(const char* path, uint64_t frames, FILE* out, bool last)
+{
+    emu::Console* console = new emu::Console();
+
+    if (!rom::testLoad(*console, path))
+    {
+        fprintf(out, "    { \"rom\": %s, \"loaded\": false }%s\n", quoted(path).c_str(), last ? "" : ",");
+        delete console;
+        return;
+    }
+
+    // power cycle before every repetition, so each one emulates the exact same frames
+    emu::limits l = {};
+    l.frames = frames;
+
+    emu::result fastest = {};
+    for (int r = 0; r < REPETITIONS; r++)
+    {
+        console->initialize();
+        rom::testLoad(*console, path);
+
+        cpu::CPU& c = console->cpu;
+        c.PS = 0x24;
+        c.PC = console->bus.read(0xFFFC) | (console->bus.read(0xFFFD) << 8);
+
+        emu::result res = emu::runHeadless(*console, l);
+        if (!r || res.seconds < fastest.seconds)
+            fastest = res;
+    }
+
+    const double s = fastest.seconds > 0 ? fastest.seconds : 1e-9;
+    fprintf(out, "    { \"rom\": %s, \"loaded\": true, \"halted\": %s, \"frames\": %llu, \"instructions\": %llu, \"cycles\": %llu, "
+        "\"seconds\": %.6f, \"mips\": %.3f, \"mhz\": %.3f, \"fps\": %.1f }%s\n",
+        quoted(path).c_str(),
+        fastest.halt == emu::Unimplemented ? "true" : "false",
+        (unsigned long long)fastest.frames,
+        (unsigned long long)fastest.instructions,
+        (unsigned long long)fastest.cycles,
+        fastest.seconds,
+        fastest.instructions / s / 1e6,
+        fastest.cycles / s / 1e6,
+        fastest.frames / s,
+        last ? "" : ",");
+
+    delete console;
+}
+
+int main(int argc, char** argv)
+{
+    const char* outPath = nullptr;
+    const char* label = "";
+    uint64_t iterations = 200000;
+    uint64_t frames = 600;
+    std::vector<const char*> roms;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+
+        if (!strcmp(argv[i], "--out") && hasValue)
+            outPath = argv[++i];
+        else if (!strcmp(argv[i], "--label") && hasValue)
+            label = argv[++i];
+        else if (!strcmp(argv[i], "--iterations") && hasValue)
+            iterations = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--frames") && hasValue)
+            frames = strtoull(argv[++i], nullptr, 10);
+        else if (argv[i][0] == '-')
+        {
+            printf("usage: bench [--out file.json] [--label text] [--iterations n] [--frames n] [rom ...]\n");
+            return -1;
+        }
+        else
+            roms.push_back(argv[i]);
+    }
+
+    if (roms.empty())
+        roms = { "rom/nestest.nes", "rom/smb.nes", "rom/dk.nes", "rom/pacman.nes" };
+
+    if (!iterations)
+        iterations = 1;
+
+    FILE* out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "[ernesto] - couldn't write %s\n", outPath);
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"label\": %s,\n  \"iterations\": %llu,\n  \"repetitions\": %d,\n", quoted(label).c_str(), (unsigned long long)iterations, REPETITIONS);
+
+    emu::Console* console = new emu::Console();
+
+    // per opcode, on both cores
+    double modeTotal[2][13] = {};
+    int modeCount[13] = {};
+
+    fprintf(out, "  \"opcodes\": [\n");
+    bool first = true;
+
+    for (int op = 0; op < 256; op++)
+    {
+        const cpu::CPU::instruction& instr = cpu::CPU::instructions[op];
+        if (!instr.impl)
+            continue;
+
+        double sw = timeOpcode(*console, op, cpu::stepSwitch, iterations);
+        double table = timeOpcode(*console, op, cpu::stepTable, iterations);
+
+        modeTotal[0][instr.mode] += sw;
+        modeTotal[1][instr.mode] += table;
+        modeCount[instr.mode]++;
+
+        fprintf(out, "%s    { \"opcode\": \"0x%02X\", \"name\": \"%s\", \"mode\": \"%s\", \"switch_ns\": %.3f, \"table_ns\": %.3f }",
+            first ? "" : ",\n", op, instr.name, modeNames[instr.mode], sw, table);
+        first = false;
+    }
+
+    fprintf(out, "\n  ],\n  \"modes\": [\n");
+    first = true;
+
+    for (int m = 0; m < 13; m++)
+    {
+        if (!modeCount[m])
+            continue;
+
+        fprintf(out, "%s    { \"mode\": \"%s\", \"opcodes\": %d, \"switch_ns\": %.3f, \"table_ns\": %.3f }",
+            first ? "" : ",\n", modeNames[m], modeCount[m], modeTotal[0][m] / modeCount[m], modeTotal[1][m] / modeCount[m]);
+        first = false;
+    }
+
+    fprintf(out, "\n  ],\n");
+
+    // the bus, with whatever cartridge comes first so PRG is mapped the way a game sees it
+    console->initialize();
+    rom::testLoad(*console, roms[0]);
+    benchBus(*console, iterations * 10, out);
+
+    delete console;
+
+    // whole ROMs
+    fprintf(out, "  \"roms\": [\n");
+    for (size_t i = 0; i < roms.size(); i++)
+        benchRom(roms[i], frames, out, i + 1 == roms.size());
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
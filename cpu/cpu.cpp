@@ -10,7 +10,14 @@
 
 using namespace cpu;
 
-cpu::CPU::instruction instructions[256];
+// inline everything the switch core calls (handlers, resolve(), addressing) into it
+#if defined(_MSC_VER)
+#define CPU_FLATTEN [[msvc::flatten]]
+#elif defined(__GNUC__)
+#define CPU_FLATTEN __attribute__((flatten))
+#else
+#define CPU_FLATTEN
+#endif
 
 void cpu::NMI(CPU& c)
 {
@@ -22,14 +29,56 @@ void cpu::NMI(CPU& c)
     
     c.pushByte(ps);
 
-    uint8_t nmi_lo = memory::read(0xFFFA);
-    uint8_t nmi_hi = memory::read(0xFFFB);
+    uint8_t nmi_lo = c.bus->read(0xFFFA);
+    uint8_t nmi_hi = c.bus->read(0xFFFB);
 
     c.PC = (nmi_hi << 8) | nmi_lo;
 
     c.setFlag(CPU::I, true);
 }
 
+void cpu::IRQ(CPU& c)
+{
+    c.pushByte((c.PC >> 8) & 0xFF);
+    c.pushByte(c.PC & 0xFF);
+
+    uint8_t ps = c.PS | 0x20;
+    ps &= ~0x10;
+
+    c.pushByte(ps);
+
+    uint8_t irq_lo = c.bus->read(0xFFFE);
+    uint8_t irq_hi = c.bus->read(0xFFFF);
+
+    c.PC = (irq_hi << 8) | irq_lo;
+
+    c.setFlag(CPU::I, true);
+}
+
+uint8_t cpu::stepTable(CPU& c)
+{
+    const CPU::instruction& instr = c.instructions[c.bus->read(c.PC)];
+
+    if (!instr.impl)
+        return 0;
+
+    instr.impl(c, instr.mode);
+
+    if (!instr.incrementPc)
+        c.PC += instr.size;
+
+    return instr.cycles + (instr.penalized ? c.penalty : 0);
+}
+
+uint8_t cpu::step(CPU& c)
+{
+#ifdef ERNESTO_TABLE_DISPATCH
+    return stepTable(c);
+#else
+    return stepSwitch(c);
+#endif
+}
+
 // Handle different addressing modes
 uint16_t cpu::addressing::immediate(CPU& c)
 {
@@ -39,28 +88,28 @@ uint16_t cpu::addressing::immediate(CPU& c)
 uint16_t cpu::addressing::zeroPage(CPU& c)
 {
     // Access an address in zero page
-    return memory::read(c.PC + 1);
+    return c.bus->read(c.PC + 1);
 }
 
 uint16_t cpu::addressing::zeroPageX(CPU& c)
 {
     // Access an address + the offset stored in the X register in zero page
-    uint8_t addr = memory::read(c.PC + 1);
+    uint8_t addr = c.bus->read(c.PC + 1);
     return (addr + c.X) & 0xFF;
 }
 
 uint16_t cpu::addressing::zeroPageY(CPU& c)
 {
     // Access an address + the offset stored in the Y register in zero page
-    uint8_t addr = memory::read(c.PC + 1);
+    uint8_t addr = c.bus->read(c.PC + 1);
     return (addr + c.Y) & 0xFF;
 }
 
 uint16_t cpu::addressing::absolute(CPU& c)
 {
     // Absolute addressing mode uses 16-bit addresses, hence why we need to read two bytes
-    uint8_t low = memory::read(c.PC + 1);
-    uint8_t high = memory::read(c.PC + 2);
+    uint8_t low = c.bus->read(c.PC + 1);
+    uint8_t high = c.bus->read(c.PC + 2);
 
     // Shift the high byte 8 bits to the left, making space for the 8 bits of the lower byte
     return (high << 8) | low;
@@ -69,8 +118,11 @@ uint16_t cpu::addressing::absolute(CPU& c)
 uint16_t cpu::addressing::absoluteX(CPU& c)
 {
     // Same as normal absolute, however the address gets offset by the value in the X register 
-    uint8_t low = memory::read(c.PC + 1);
-    uint8_t high = memory::read(c.PC + 2);
+    uint8_t low = c.bus->read(c.PC + 1);
+    uint8_t high = c.bus->read(c.PC + 2);
+
+    // crossing into the next page costs reads an extra cycle
+    c.penalty = (low + c.X) > 0xFF;
 
     return ((high << 8) | low) + c.X;
 }
@@ -78,8 +130,10 @@ uint16_t cpu::addressing::absoluteX(CPU& c)
 uint16_t cpu::addressing::absoluteY(CPU& c)
 {
     // Same as normal absolute, however the address gets offset by the value in the Y register
-    uint8_t low = memory::read(c.PC + 1);
-    uint8_t high = memory::read(c.PC + 2);
+    uint8_t low = c.bus->read(c.PC + 1);
+    uint8_t high = c.bus->read(c.PC + 2);
+
+    c.penalty = (low + c.Y) > 0xFF;
 
     return ((high << 8) | low) + c.Y;
 }
@@ -87,14 +141,14 @@ uint16_t cpu::addressing::absoluteY(CPU& c)
 uint16_t cpu::addressing::indirect(CPU& c)
 {
     // this is only used by JMP, pretty similar to absolute addressing mode but targetting a pointer instead
-    uint8_t low = memory::read(c.PC + 1);
-    uint8_t high = memory::read(c.PC + 2);
+    uint8_t low = c.bus->read(c.PC + 1);
+    uint8_t high = c.bus->read(c.PC + 2);
 
     uint16_t ptr = (high << 8 | low);
 
     // read the address in ptr
-    uint8_t ptrL = memory::read(ptr);
-    uint8_t ptrH = memory::read((ptr & 0xFF00) | ((ptr + 1) & 0x00FF));
+    uint8_t ptrL = c.bus->read(ptr);
+    uint8_t ptrH = c.bus->read((ptr & 0xFF00) | ((ptr + 1) & 0x00FF));
 
     uint16_t result = (ptrH << 8 | ptrL);
     return result;
@@ -103,9 +157,9 @@ uint16_t cpu::addressing::indirect(CPU& c)
 uint16_t cpu::addressing::indirectX(CPU& c)
 {
     // target is pointer in zero page, offset by X
-    uint16_t base = (memory::read(c.PC + 1) + c.X) & 0xFF;
-    uint8_t low = memory::read(base);
-    uint8_t high = memory::read(base + 1) & 0xFF;
+    uint16_t base = (c.bus->read(c.PC + 1) + c.X) & 0xFF;
+    uint8_t low = c.bus->read(base);
+    uint8_t high = c.bus->read((base + 1) & 0xFF); // the pointer wraps around inside zero page
 
     return (high << 8) | low; 
 }
@@ -113,12 +167,14 @@ uint16_t cpu::addressing::indirectX(CPU& c)
 uint16_t cpu::addressing::indirectY(CPU& c)
 {
     // target is pointer in zero page, offset by Y
-    uint8_t zp = memory::read(c.PC + 1);
+    uint8_t zp = c.bus->read(c.PC + 1);
 
-    uint8_t low = memory::read(zp);
-    uint8_t high = memory::read((zp + 1) & 0xFF);
+    uint8_t low = c.bus->read(zp);
+    uint8_t high = c.bus->read((zp + 1) & 0xFF);
     uint16_t base = (high << 8) | low;
 
+    c.penalty = (low + c.Y) > 0xFF;
+
     return base + c.Y;
 }
 
@@ -126,7 +182,7 @@ int16_t cpu::addressing::relative(CPU& c)
 {
     // mainly used for branches
     // 8 bit SIGNED offset
-    return static_cast<int8_t>(memory::read(c.PC + 1));
+    return static_cast<int8_t>(c.bus->read(c.PC + 1));
 }
 
 void cpu::addressing::implied(CPU& c)
@@ -172,7 +228,7 @@ void cpu::opcodes::LDA(CPU& c, CPU::addressingMode mode)
 {
     // bear in mind: all addressing modes return unsigned integers except for relative mode
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     c.A = operand;
     c.setFlag(CPU::Z, (operand == 0));
@@ -183,14 +239,14 @@ void cpu::opcodes::LDA(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::STA(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    memory::write(address, c.A);
+    c.bus->write(address, c.A);
 }
 
 // LDX - loads the content of operand into the X register
 void cpu::opcodes::LDX(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     c.X = operand;
     c.setFlag(CPU::Z, (operand == 0));
@@ -201,14 +257,14 @@ void cpu::opcodes::LDX(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::STX(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    memory::write(address, c.X);
+    c.bus->write(address, c.X);
 }
 
 // LDY - loads the content of operand into the Y register
 void cpu::opcodes::LDY(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     c.Y = operand;
     c.setFlag(CPU::Z, (operand == 0));
@@ -219,7 +275,7 @@ void cpu::opcodes::LDY(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::STY(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    memory::write(address, c.Y);
+    c.bus->write(address, c.Y);
 }
 
 // TAX - transfers X to A
@@ -263,7 +319,7 @@ void cpu::opcodes::ADC(CPU& c, CPU::addressingMode mode)
 {
     // A = A + memory + C
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     uint8_t oldA = c.A;
 
@@ -281,7 +337,7 @@ void cpu::opcodes::ADC(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::SBC(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     uint8_t oldA = c.A;  // Save old A for overflow calculation
 
@@ -302,11 +358,11 @@ void cpu::opcodes::SBC(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::INC(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
     uint8_t result = operand + 1;
 
     // Write the incremented value
-    memory::write(address, result);
+    c.bus->write(address, result);
 
     // Set flags based on the result
     c.setFlag(CPU::Z, result == 0);
@@ -337,13 +393,13 @@ void cpu::opcodes::DEC(CPU& c, CPU::addressingMode mode)
 {
     // memory = memory - 1
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     // write the original value first
-    memory::write(address, operand);
+    c.bus->write(address, operand);
 
     // now we increment
-    memory::write(address, operand - 1);
+    c.bus->write(address, operand - 1);
 
     c.setFlag(CPU::Z, (operand - 1) == 0);
     c.setFlag(CPU::N, (operand - 1) & 0x80);
@@ -373,7 +429,7 @@ void cpu::opcodes::DEY(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::ASL(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = mode == CPU::Accumulator ? c.A : memory::read(address);
+    uint8_t operand = mode == CPU::Accumulator ? c.A : c.bus->read(address);
 
     // we carry the last bit of the old value for 8-bit behavior
     c.setFlag(CPU::C, operand & 0x80);
@@ -381,7 +437,7 @@ void cpu::opcodes::ASL(CPU& c, CPU::addressingMode mode)
     uint8_t result = operand << 1;
 
     if (mode != CPU::Accumulator)
-        memory::write(address, result);
+        c.bus->write(address, result);
     else
         c.A = result;
 
@@ -394,7 +450,7 @@ void cpu::opcodes::ASL(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::LSR(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = mode == CPU::Accumulator ? c.A : memory::read(address);
+    uint8_t operand = mode == CPU::Accumulator ? c.A : c.bus->read(address);
 
     // we carry the last bit of the old value for 8-bit behavior
     c.setFlag(CPU::C, operand & 0x01);
@@ -402,7 +458,7 @@ void cpu::opcodes::LSR(CPU& c, CPU::addressingMode mode)
     uint8_t result = operand >> 1;
 
     if (mode != CPU::Accumulator)
-        memory::write(address, result);
+        c.bus->write(address, result);
     else
         c.A = result;
 
@@ -415,14 +471,15 @@ void cpu::opcodes::LSR(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::ROL(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = mode == CPU::Accumulator ? c.A : memory::read(address);
+    uint8_t operand = mode == CPU::Accumulator ? c.A : c.bus->read(address);
 
-    c.setFlag(CPU::C, operand & 0x80);
+    // the old carry goes into bit 0, so don't touch C until after the shift
+    bool oldCarry = c.getFlag(CPU::C);
 
-    uint8_t result = (operand << 1) | (c.getFlag(CPU::C) ? 1 : 0);
+    uint8_t result = (operand << 1) | (oldCarry ? 1 : 0);
 
     if (mode != CPU::Accumulator)
-        memory::write(address, result);
+        c.bus->write(address, result);
     else
         c.A = result;
 
@@ -435,7 +492,7 @@ void cpu::opcodes::ROL(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::ROR(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = mode == CPU::Accumulator ? c.A : memory::read(address);
+    uint8_t operand = mode == CPU::Accumulator ? c.A : c.bus->read(address);
 
     bool oldCarry = c.getFlag(CPU::C);
     bool newCarry = operand & 0x01;
@@ -443,7 +500,7 @@ void cpu::opcodes::ROR(CPU& c, CPU::addressingMode mode)
     uint8_t result = (operand >> 1) | (oldCarry ? 0x80 : 0x00);
 
     if (mode != CPU::Accumulator)
-        memory::write(address, result);
+        c.bus->write(address, result);
     else
         c.A = result;
 
@@ -456,7 +513,7 @@ void cpu::opcodes::ROR(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::AND(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
     uint8_t result = c.A & operand;
 
     c.A = result;
@@ -468,7 +525,7 @@ void cpu::opcodes::AND(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::ORA(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
     uint8_t result = c.A | operand;
 
     c.A = result;
@@ -480,7 +537,7 @@ void cpu::opcodes::ORA(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::EOR(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
     uint8_t result = c.A ^ operand;
 
     c.A = result;
@@ -492,7 +549,7 @@ void cpu::opcodes::EOR(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::BIT(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
     uint8_t result = c.A & operand;
 
     c.setFlag(CPU::Z, result == 0);
@@ -504,7 +561,7 @@ void cpu::opcodes::BIT(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::CMP(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
     uint8_t result = c.A - operand;
 
     c.setFlag(CPU::C, (c.A >= operand));
@@ -516,7 +573,7 @@ void cpu::opcodes::CMP(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::CPX(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
     uint8_t result = c.X - operand;
 
     c.setFlag(CPU::C, (c.X >= operand));
@@ -528,7 +585,7 @@ void cpu::opcodes::CPX(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::CPY(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
     uint8_t result = c.Y - operand;
 
     c.setFlag(CPU::C, (c.Y >= operand));
@@ -536,129 +593,88 @@ void cpu::opcodes::CPY(CPU& c, CPU::addressingMode mode)
     c.setFlag(CPU::N, result & 0x80);
 }
 
-// BCC - Branch if Carry Clear
-void cpu::opcodes::BCC(CPU& c, CPU::addressingMode mode)
+// shared by every branch, a taken branch costs 1 more cycle, 2 if it lands on another page
+static void branch(CPU& c, CPU::addressingMode mode, bool taken)
 {
     int8_t offset = static_cast<int8_t>(cpu::addressing::resolve(c, mode));
 
     uint16_t next = c.PC + 2;
 
-    if (!c.getFlag(CPU::C))
-        c.PC = next + offset;
-    else
+    if (!taken)
+    {
         c.PC = next;
+        c.penalty = 0;
+        return;
+    }
+
+    c.PC = next + offset;
+    c.penalty = ((c.PC ^ next) & 0xFF00) ? 2 : 1;
+}
+
+// BCC - Branch if Carry Clear
+void cpu::opcodes::BCC(CPU& c, CPU::addressingMode mode)
+{
+    branch(c, mode, !c.getFlag(CPU::C));
 }
 
 // BCS - Branch if Carry Set
 void cpu::opcodes::BCS(CPU& c, CPU::addressingMode mode)
 {
-    int8_t offset = static_cast<int8_t>(cpu::addressing::resolve(c, mode));
-
-    uint16_t next = c.PC + 2;
-
-    if (c.getFlag(CPU::C))
-        c.PC = next + offset;
-    else
-        c.PC = next;
+    branch(c, mode, c.getFlag(CPU::C));
 }
 
 // BCC - Branch if Equal
 void cpu::opcodes::BEQ(CPU& c, CPU::addressingMode mode)
 {
-    int8_t offset = static_cast<int8_t>(cpu::addressing::resolve(c, mode));
-
-    uint16_t next = c.PC + 2;
-
-    if (c.getFlag(CPU::Z))
-        c.PC = next + offset;
-    else
-        c.PC = next;
+    branch(c, mode, c.getFlag(CPU::Z));
 }
 
 // BNE - Branch if Not Equal
 void cpu::opcodes::BNE(CPU& c, CPU::addressingMode mode)
 {
-    int8_t offset = static_cast<int8_t>(cpu::addressing::resolve(c, mode));
-
-    uint16_t next = c.PC + 2;
-
-    if (!c.getFlag(CPU::Z))
-        c.PC = next + offset;
-    else
-        c.PC = next;
+    branch(c, mode, !c.getFlag(CPU::Z));
 }
 
 // BPL - Branch if Plus
 void cpu::opcodes::BPL(CPU& c, CPU::addressingMode mode)
 {
-    int8_t offset = static_cast<int8_t>(cpu::addressing::resolve(c, mode));
-
-    uint16_t next = c.PC + 2;
-
-    if (!c.getFlag(CPU::N))
-        c.PC = next + offset;
-    else
-        c.PC = next;
+    branch(c, mode, !c.getFlag(CPU::N));
 }
 
 // BMI - Branch if Minus
 void cpu::opcodes::BMI(CPU& c, CPU::addressingMode mode)
 {
-    int8_t offset = static_cast<int8_t>(cpu::addressing::resolve(c, mode));
-
-    uint16_t next = c.PC + 2;
-
-    if (c.getFlag(CPU::N))
-        c.PC = next + offset;
-    else
-        c.PC = next;
+    branch(c, mode, c.getFlag(CPU::N));
 }
 
 // BVC - Branch if Overflow Clear
 void cpu::opcodes::BVC(CPU& c, CPU::addressingMode mode)
 {
-    int8_t offset = static_cast<int8_t>(cpu::addressing::resolve(c, mode));
-
-    uint16_t next = c.PC + 2;
-
-    if (!c.getFlag(CPU::V))
-        c.PC = next + offset;
-    else
-        c.PC = next;
+    branch(c, mode, !c.getFlag(CPU::V));
 }
 
 // BVS - Branch if Overflow Set
 void cpu::opcodes::BVS(CPU& c, CPU::addressingMode mode)
 {
-    int8_t offset = static_cast<int8_t>(cpu::addressing::resolve(c, mode));
-
-    uint16_t next = c.PC + 2;
-
-    if (c.getFlag(CPU::V))
-        c.PC = next + offset;
-    else
-        c.PC = next;
+    branch(c, mode, c.getFlag(CPU::V));
 }
 
 // JMP - Jump!
 void cpu::opcodes::JMP(CPU& c, CPU::addressingMode mode)
 {
-    uint16_t address = cpu::addressing::resolve(c, mode);
-    uint16_t operand = memory::read(address);
-
-    c.PC = (mode == CPU::Absolute || mode == CPU::Indirect ? address : operand);
+    // absolute and indirect both resolve to the target itself, nothing is read from it
+    c.PC = cpu::addressing::resolve(c, mode);
 }
 
 // JSR - Jump to subroutine
 void cpu::opcodes::JSR(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint16_t operand = memory::read(address);
     uint16_t returnAddr = c.PC + 2;
     c.pushByte((returnAddr >> 8) & 0xFF);
     c.pushByte(returnAddr & 0xFF);
 
-    c.PC = (mode == CPU::Absolute ? address : operand);
+    c.PC = address;
 }
 
 // RTS - Return from subroutine
@@ -799,7 +815,7 @@ void cpu::opcodes::NOP(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::LAX(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     c.A = operand;
     c.X = operand;
@@ -808,22 +824,33 @@ void cpu::opcodes::LAX(CPU& c, CPU::addressingMode mode)
 
 }
 
+// ANC - AND with the operand, bit 7 of the result also goes into carry
+void cpu::opcodes::ANC(CPU& c, CPU::addressingMode mode)
+{
+    uint16_t address = cpu::addressing::resolve(c, mode);
+    c.A &= c.bus->read(address);
+
+    c.setFlag(CPU::Z, (c.A == 0));
+    c.setFlag(CPU::N, (c.A & 0x80));
+    c.setFlag(CPU::C, (c.A & 0x80));
+}
+
 // SAX - Store A and X
 void cpu::opcodes::SAX(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
     uint8_t value = c.A & c.X;
-    memory::write(address, value);
+    c.bus->write(address, value);
 }
 
 // DCP - Decrements the operand and compares the result to the accumulator
 void cpu::opcodes::DCP(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     uint8_t value = (operand - 1);
-    memory::write(address, value);
+    c.bus->write(address, value);
 
     uint8_t result = c.A - value;
 
@@ -836,12 +863,12 @@ void cpu::opcodes::DCP(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::ISC(CPU& c, CPU::addressingMode mode)
 {
     uint16_t addr = cpu::addressing::resolve(c, mode);
-    uint8_t value = memory::read(addr);
+    uint8_t value = c.bus->read(addr);
     value += 1;
-    memory::write(addr, value);
+    c.bus->write(addr, value);
 
     // Effective SBC with carry
-    uint16_t borrow = c.C ? 0 : 1;
+    uint16_t borrow = c.getFlag(CPU::C) ? 0 : 1;
     uint16_t result = static_cast<uint16_t>(c.A) - value - borrow;
 
     // Update flags
@@ -859,7 +886,7 @@ void cpu::opcodes::RLA(CPU& c, CPU::addressingMode mode)
 {
     // rotate left first
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     bool oldCarry = c.getFlag(CPU::C);
     bool newCarry = operand & 0x80;
@@ -867,7 +894,7 @@ void cpu::opcodes::RLA(CPU& c, CPU::addressingMode mode)
     uint8_t result = (operand << 1) | (oldCarry ? 1 : 0);
 
     // write C <- 0x80 <- C to memory
-    memory::write(address, result);
+    c.bus->write(address, result);
 
     // write the result of M AND A to A
     c.A &= result;
@@ -881,7 +908,7 @@ void cpu::opcodes::RLA(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::SLO(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     // we carry the last bit of the old value for 8-bit behavior
     c.setFlag(CPU::C, operand & 0x80);
@@ -889,7 +916,7 @@ void cpu::opcodes::SLO(CPU& c, CPU::addressingMode mode)
     uint8_t result = operand << 1;
 
     // write C <- SHIFT LEFT <- 0 to M
-    memory::write(address, result);
+    c.bus->write(address, result);
 
     // write the result of M OR A to A
     c.A |= result;
@@ -903,7 +930,7 @@ void cpu::opcodes::SLO(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::SRE(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     // we carry the last bit of the old value for 8-bit behavior
     c.setFlag(CPU::C, operand & 0x01);
@@ -911,7 +938,7 @@ void cpu::opcodes::SRE(CPU& c, CPU::addressingMode mode)
     uint8_t result = operand >> 1;
 
     // write to memory
-    memory::write(address, result);
+    c.bus->write(address, result);
 
     // write A EOR M -> A
     c.A ^= result;
@@ -925,7 +952,7 @@ void cpu::opcodes::SRE(CPU& c, CPU::addressingMode mode)
 void cpu::opcodes::RRA(CPU& c, CPU::addressingMode mode)
 {
     uint16_t address = cpu::addressing::resolve(c, mode);
-    uint8_t operand = memory::read(address);
+    uint8_t operand = c.bus->read(address);
 
     bool oldCarry = c.getFlag(CPU::C);
     bool newCarry = (operand & 0x01);
@@ -933,7 +960,7 @@ void cpu::opcodes::RRA(CPU& c, CPU::addressingMode mode)
     uint8_t result = (operand >> 1) | (oldCarry ? 0x80 : 0x00);
 
     // write result to memory
-    memory::write(address, result);
+    c.bus->write(address, result);
 
     uint16_t sum = c.A + result + (newCarry ? 1 : 0);
 
@@ -956,14 +983,14 @@ uint8_t& cpu::addressing::accumulator(CPU& c)
 void CPU::pushByte(uint16_t value)
 {
     // Stack begins at 0x0100
-    memory::write(0x0100 + SP, value);
+    bus->write(0x0100 + SP, value);
     SP--;
 }
 
 uint16_t CPU::pullByte()
 {
     SP++;
-    return memory::read(0x0100 + SP);
+    return bus->read(0x0100 + SP);
 }
 
 void CPU::setFlag(flags flag, bool value)
@@ -981,298 +1008,66 @@ bool CPU::getFlag(flags flag) const
     return PS & flag;
 }
 
-void CPU::populate()
-{
-    // populate instructions
-    cpu::CPU::instructions[0x69] = { "ADC", Immediate, 2, 2, false, opcodes::ADC };
-    cpu::CPU::instructions[0x65] = { "ADC", ZeroPage, 2, 3, false, opcodes::ADC };
-    cpu::CPU::instructions[0x75] = { "ADC", ZeroPageX, 2, 4, false, opcodes::ADC };
-    cpu::CPU::instructions[0x6D] = { "ADC", Absolute, 3, 4, false, opcodes::ADC };
-    cpu::CPU::instructions[0x7D] = { "ADC", AbsoluteX, 3, 4, false, opcodes::ADC };
-    cpu::CPU::instructions[0x79] = { "ADC", AbsoluteY, 3, 4, false, opcodes::ADC };
-    cpu::CPU::instructions[0x61] = { "ADC", IdxIndirect, 2, 6, false, opcodes::ADC };
-    cpu::CPU::instructions[0x71] = { "ADC", IndirectIdx, 2, 5, false, opcodes::ADC };
-
-    cpu::CPU::instructions[0x29] = { "AND", Immediate, 2, 2, false, opcodes::AND };
-    cpu::CPU::instructions[0x25] = { "AND", ZeroPage, 2, 3, false, opcodes::AND };
-    cpu::CPU::instructions[0x35] = { "AND", ZeroPageX, 2, 4, false, opcodes::AND };
-    cpu::CPU::instructions[0x2D] = { "AND", Absolute, 3, 4, false, opcodes::AND };
-    cpu::CPU::instructions[0x3D] = { "AND", AbsoluteX, 3, 4, false, opcodes::AND };
-    cpu::CPU::instructions[0x39] = { "AND", AbsoluteY, 3, 4, false, opcodes::AND };
-    cpu::CPU::instructions[0x21] = { "AND", IdxIndirect, 2, 6, false, opcodes::AND };
-    cpu::CPU::instructions[0x31] = { "AND", IndirectIdx, 2, 5, false, opcodes::AND };
-
-    cpu::CPU::instructions[0x0A] = { "ASL", Accumulator, 1, 2, false, opcodes::ASL };
-    cpu::CPU::instructions[0x06] = { "ASL", ZeroPage, 2, 5, false, opcodes::ASL };
-    cpu::CPU::instructions[0x16] = { "ASL", ZeroPageX, 2, 6, false, opcodes::ASL };
-    cpu::CPU::instructions[0x0E] = { "ASL", Absolute, 3, 6, false, opcodes::ASL };
-    cpu::CPU::instructions[0x1E] = { "ASL", AbsoluteX, 3, 7, false, opcodes::ASL };
-
-    cpu::CPU::instructions[0x90] = { "BCC", Relative, 2, 1, true, opcodes::BCC };
-    cpu::CPU::instructions[0xB0] = { "BCS", Relative, 2, 1, true, opcodes::BCS };
-    cpu::CPU::instructions[0xF0] = { "BEQ", Relative, 2, 1, true, opcodes::BEQ };
-    cpu::CPU::instructions[0x30] = { "BMI", Relative, 2, 1, true, opcodes::BMI };
-    cpu::CPU::instructions[0xD0] = { "BNE", Relative, 2, 1, true, opcodes::BNE };
-    cpu::CPU::instructions[0x10] = { "BPL", Relative, 2, 1, true, opcodes::BPL };
-    cpu::CPU::instructions[0x50] = { "BVC", Relative, 2, 1, true, opcodes::BVC };
-    cpu::CPU::instructions[0x70] = { "BVS", Relative, 2, 1, true, opcodes::BVS };
-
-    cpu::CPU::instructions[0x00] = { "BRK", Implicit, 1, 7, false, opcodes::BRK };
-    cpu::CPU::instructions[0x00] = { "BRK", Immediate, 1, 7, false, opcodes::BRK };
-
-    cpu::CPU::instructions[0x18] = { "CLC", Implicit, 1, 2, false, opcodes::CLC };
-    cpu::CPU::instructions[0xD8] = { "CLD", Implicit, 1, 2, false, opcodes::CLD };
-    cpu::CPU::instructions[0x58] = { "CLI", Implicit, 1, 2, false, opcodes::CLI };
-    cpu::CPU::instructions[0xB8] = { "CLV", Implicit, 1, 2, false, opcodes::CLV };
-
-    cpu::CPU::instructions[0x24] = { "BIT", ZeroPage, 2, 3, false, opcodes::BIT };
-    cpu::CPU::instructions[0x2C] = { "BIT", Absolute, 3, 4, false, opcodes::BIT };
-
-    cpu::CPU::instructions[0xC9] = { "CMP", Immediate, 2, 2, false, opcodes::CMP };
-    cpu::CPU::instructions[0xC5] = { "CMP", ZeroPage, 2, 3, false, opcodes::CMP };
-    cpu::CPU::instructions[0xD5] = { "CMP", ZeroPageX, 2, 4, false, opcodes::CMP };
-    cpu::CPU::instructions[0xCD] = { "CMP", Absolute, 3, 4, false, opcodes::CMP };
-    cpu::CPU::instructions[0xDD] = { "CMP", AbsoluteX, 3, 4, false, opcodes::CMP };
-    cpu::CPU::instructions[0xD9] = { "CMP", AbsoluteY, 3, 4, false, opcodes::CMP };
-    cpu::CPU::instructions[0xC1] = { "CMP", IdxIndirect, 2, 6, false, opcodes::CMP };
-    cpu::CPU::instructions[0xD1] = { "CMP", IndirectIdx, 2, 5, false, opcodes::CMP };
-
-    cpu::CPU::instructions[0xE0] = { "CPX", Immediate, 2, 2, false, opcodes::CPX };
-    cpu::CPU::instructions[0xE4] = { "CPX", ZeroPage, 2, 3, false, opcodes::CPX };
-    cpu::CPU::instructions[0xEC] = { "CPX", Absolute, 3, 4, false, opcodes::CPX };
-
-    cpu::CPU::instructions[0xC0] = { "CPY", Immediate, 2, 2, false, opcodes::CPY };
-    cpu::CPU::instructions[0xC4] = { "CPY", ZeroPage, 2, 3, false, opcodes::CPY };
-    cpu::CPU::instructions[0xCC] = { "CPY", Absolute, 3, 4, false, opcodes::CPY };
-
-    cpu::CPU::instructions[0xC6] = { "DEC", ZeroPage, 2, 5, false, opcodes::DEC };
-    cpu::CPU::instructions[0xD6] = { "DEC", ZeroPageX, 2, 6, false, opcodes::DEC };
-    cpu::CPU::instructions[0xCE] = { "DEC", Absolute, 3, 6, false, opcodes::DEC };
-    cpu::CPU::instructions[0xDE] = { "DEC", AbsoluteX, 3, 7, false, opcodes::DEC };
-
-    cpu::CPU::instructions[0xCA] = { "DEX", Implicit, 1, 2, false, opcodes::DEX };
-    cpu::CPU::instructions[0x88] = { "DEY", Implicit, 1, 2, false, opcodes::DEY };
-
-    cpu::CPU::instructions[0xE6] = { "INC", ZeroPage, 2, 5, false, opcodes::INC };
-    cpu::CPU::instructions[0xF6] = { "INC", ZeroPageX, 2, 6, false, opcodes::INC };
-    cpu::CPU::instructions[0xEE] = { "INC", Absolute, 3, 6, false, opcodes::INC };
-    cpu::CPU::instructions[0xFE] = { "INC", AbsoluteX, 3, 7, false, opcodes::INC };
-
-    cpu::CPU::instructions[0xE8] = { "INX", Implicit, 1, 2, false, opcodes::INX };
-    cpu::CPU::instructions[0xC8] = { "INY", Implicit, 1, 2, false, opcodes::INY };
-
-    cpu::CPU::instructions[0x49] = { "EOR", Immediate, 2, 2, false, opcodes::EOR };
-    cpu::CPU::instructions[0x45] = { "EOR", ZeroPage, 2, 3, false, opcodes::EOR };
-    cpu::CPU::instructions[0x55] = { "EOR", ZeroPageX, 2, 4, false, opcodes::EOR };
-    cpu::CPU::instructions[0x4D] = { "EOR", Absolute, 3, 4, false, opcodes::EOR };
-    cpu::CPU::instructions[0x5D] = { "EOR", AbsoluteX, 3, 4, false, opcodes::EOR };
-    cpu::CPU::instructions[0x59] = { "EOR", AbsoluteY, 3, 4, false, opcodes::EOR };
-    cpu::CPU::instructions[0x41] = { "EOR", IdxIndirect, 2, 6, false, opcodes::EOR };
-    cpu::CPU::instructions[0x51] = { "EOR", IndirectIdx, 2, 5, false, opcodes::EOR };
-
-    cpu::CPU::instructions[0x4C] = { "JMP", Absolute, 3, 3, true, opcodes::JMP };
-    cpu::CPU::instructions[0x6C] = { "JMP", Indirect, 3, 5, true, opcodes::JMP };
-    cpu::CPU::instructions[0x20] = { "JSR", Absolute, 3, 6, true, opcodes::JSR };
-
-    cpu::CPU::instructions[0xA9] = { "LDA", Immediate, 2, 2, false, opcodes::LDA };
-    cpu::CPU::instructions[0xA5] = { "LDA", ZeroPage, 2, 3, false, opcodes::LDA };
-    cpu::CPU::instructions[0xB5] = { "LDA", ZeroPageX, 2, 4, false, opcodes::LDA };
-    cpu::CPU::instructions[0xAD] = { "LDA", Absolute, 3, 4, false, opcodes::LDA };
-    cpu::CPU::instructions[0xBD] = { "LDA", AbsoluteX, 3, 4, false, opcodes::LDA };
-    cpu::CPU::instructions[0xB9] = { "LDA", AbsoluteY, 3, 4, false, opcodes::LDA };
-    cpu::CPU::instructions[0xA1] = { "LDA", IdxIndirect, 2, 6, false, opcodes::LDA };
-    cpu::CPU::instructions[0xB1] = { "LDA", IndirectIdx, 2, 5, false, opcodes::LDA };
-
-    cpu::CPU::instructions[0xA2] = { "LDX", Immediate, 2, 2, false, opcodes::LDX };
-    cpu::CPU::instructions[0xA6] = { "LDX", ZeroPage, 2, 3, false, opcodes::LDX };
-    cpu::CPU::instructions[0xB6] = { "LDX", ZeroPageY, 2, 4, false, opcodes::LDX };
-    cpu::CPU::instructions[0xAE] = { "LDX", Absolute, 3, 4, false, opcodes::LDX };
-    cpu::CPU::instructions[0xBE] = { "LDX", AbsoluteY, 3, 4, false, opcodes::LDX };
-
-    cpu::CPU::instructions[0xA0] = { "LDY", Immediate, 2, 2, false, opcodes::LDY };
-    cpu::CPU::instructions[0xA4] = { "LDY", ZeroPage, 2, 3, false, opcodes::LDY };
-    cpu::CPU::instructions[0xB4] = { "LDY", ZeroPageX, 2, 4, false, opcodes::LDY };
-    cpu::CPU::instructions[0xAC] = { "LDY", Absolute, 3, 4, false, opcodes::LDY };
-    cpu::CPU::instructions[0xBC] = { "LDY", AbsoluteX, 3, 4, false, opcodes::LDY };
-
-    cpu::CPU::instructions[0x4A] = { "LSR", Accumulator, 1, 2, false, opcodes::LSR };
-    cpu::CPU::instructions[0x46] = { "LSR", ZeroPage, 2, 5, false, opcodes::LSR };
-    cpu::CPU::instructions[0x56] = { "LSR", ZeroPageX, 2, 6, false, opcodes::LSR };
-    cpu::CPU::instructions[0x4E] = { "LSR", Absolute, 3, 6, false, opcodes::LSR };
-    cpu::CPU::instructions[0x5E] = { "LSR", AbsoluteX, 3, 7, false, opcodes::LSR };
-
-    cpu::CPU::instructions[0xB2] = { "NOP", Implicit, 1, 1, false, opcodes::NOP };
-    cpu::CPU::instructions[0x2B] = { "NOP", Implicit, 1, 1, false, opcodes::NOP };
-    cpu::CPU::instructions[0x0B] = { "NOP", Implicit, 1, 1, false, opcodes::NOP };
-    cpu::CPU::instructions[0x1A] = { "NOP", Implicit, 1, 2, false, opcodes::NOP };
-    cpu::CPU::instructions[0x3A] = { "NOP", Implicit, 1, 2, false, opcodes::NOP };
-    cpu::CPU::instructions[0x5A] = { "NOP", Implicit, 1, 2, false, opcodes::NOP };
-    cpu::CPU::instructions[0x7A] = { "NOP", Implicit, 1, 2, false, opcodes::NOP };
-    cpu::CPU::instructions[0xDA] = { "NOP", Implicit, 1, 2, false, opcodes::NOP };
-    cpu::CPU::instructions[0xFA] = { "NOP", Implicit, 1, 2, false, opcodes::NOP };
-    cpu::CPU::instructions[0xEA] = { "NOP", Implicit, 1, 2, false, opcodes::NOP };
-    cpu::CPU::instructions[0x80] = { "NOP", Immediate, 2, 2, false, opcodes::NOP };
-    cpu::CPU::instructions[0x04] = { "NOP", ZeroPage, 2, 3, false, opcodes::NOP };
-    cpu::CPU::instructions[0x44] = { "NOP", ZeroPageX, 2, 3, false, opcodes::NOP };
-    cpu::CPU::instructions[0x64] = { "NOP", ZeroPageX, 2, 3, false, opcodes::NOP };
-    cpu::CPU::instructions[0x14] = { "NOP", ZeroPageX, 2, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0x34] = { "NOP", ZeroPageX, 2, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0x54] = { "NOP", ZeroPageX, 2, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0x74] = { "NOP", ZeroPageX, 2, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0xD4] = { "NOP", ZeroPageX, 2, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0xF4] = { "NOP", ZeroPageX, 2, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0x0C] = { "NOP", Absolute, 3, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0x1C] = { "NOP", AbsoluteX, 3, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0x3C] = { "NOP", AbsoluteX, 3, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0x5C] = { "NOP", AbsoluteX, 3, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0x7C] = { "NOP", AbsoluteX, 3, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0xDC] = { "NOP", AbsoluteX, 3, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0xFC] = { "NOP", AbsoluteX, 3, 4, false, opcodes::NOP };
-    cpu::CPU::instructions[0x89] = { "NOP", Immediate, 2, 2, false, opcodes::NOP };
-
-    cpu::CPU::instructions[0x09] = { "ORA", Immediate, 2, 2, false, opcodes::ORA };
-    cpu::CPU::instructions[0x05] = { "ORA", ZeroPage, 2, 3, false, opcodes::ORA };
-    cpu::CPU::instructions[0x15] = { "ORA", ZeroPageX, 2, 4, false, opcodes::ORA };
-    cpu::CPU::instructions[0x0D] = { "ORA", Absolute, 3, 4, false, opcodes::ORA };
-    cpu::CPU::instructions[0x1D] = { "ORA", AbsoluteX, 3, 4, false, opcodes::ORA };
-    cpu::CPU::instructions[0x19] = { "ORA", AbsoluteY, 3, 4, false, opcodes::ORA };
-    cpu::CPU::instructions[0x01] = { "ORA", IdxIndirect, 2, 6, false, opcodes::ORA };
-    cpu::CPU::instructions[0x11] = { "ORA", IndirectIdx, 2, 5, false, opcodes::ORA };
-
-    cpu::CPU::instructions[0x48] = { "PHA", Implicit, 1, 3, false, opcodes::PHA };
-    cpu::CPU::instructions[0x08] = { "PHP", Implicit, 1, 3, false, opcodes::PHP };
-    cpu::CPU::instructions[0x68] = { "PLA", Implicit, 1, 4, false, opcodes::PLA };
-    cpu::CPU::instructions[0x28] = { "PLP", Implicit, 1, 4, false, opcodes::PLP };
-
-    cpu::CPU::instructions[0x2A] = { "ROL", Accumulator, 1, 2, false, opcodes::ROL };
-    cpu::CPU::instructions[0x26] = { "ROL", ZeroPage, 2, 5, false, opcodes::ROL };
-    cpu::CPU::instructions[0x36] = { "ROL", ZeroPageX, 2, 6, false, opcodes::ROL };
-    cpu::CPU::instructions[0x2E] = { "ROL", Absolute, 3, 6, false, opcodes::ROL };
-    cpu::CPU::instructions[0x3E] = { "ROL", AbsoluteX, 3, 7, false, opcodes::ROL };
-
-    cpu::CPU::instructions[0x6A] = { "ROR", Accumulator, 1, 2, false, opcodes::ROR };
-    cpu::CPU::instructions[0x66] = { "ROR", ZeroPage, 2, 5, false, opcodes::ROR };
-    cpu::CPU::instructions[0x76] = { "ROR", ZeroPageX, 2, 6, false, opcodes::ROR };
-    cpu::CPU::instructions[0x6E] = { "ROR", Absolute, 3, 6, false, opcodes::ROR };
-    cpu::CPU::instructions[0x7E] = { "ROR", AbsoluteX, 3, 7, false, opcodes::ROR };
-
-    cpu::CPU::instructions[0x40] = { "RTI", Implicit, 1, 6, true, opcodes::RTI };
-    cpu::CPU::instructions[0x60] = { "RTS", Implicit, 1, 6, true, opcodes::RTS };
-
-    cpu::CPU::instructions[0xE9] = { "SBC", Immediate, 2, 2, false, opcodes::SBC };
-    cpu::CPU::instructions[0xE5] = { "SBC", ZeroPage, 2, 3, false, opcodes::SBC };
-    cpu::CPU::instructions[0xF5] = { "SBC", ZeroPageX, 2, 4, false, opcodes::SBC };
-    cpu::CPU::instructions[0xED] = { "SBC", Absolute, 3, 4, false, opcodes::SBC };
-    cpu::CPU::instructions[0xFD] = { "SBC", AbsoluteX, 3, 4, false, opcodes::SBC };
-    cpu::CPU::instructions[0xF9] = { "SBC", AbsoluteY, 3, 4, false, opcodes::SBC };
-    cpu::CPU::instructions[0xE1] = { "SBC", IdxIndirect, 2, 6, false, opcodes::SBC };
-    cpu::CPU::instructions[0xF1] = { "SBC", IndirectIdx, 2, 5, false, opcodes::SBC };
-    cpu::CPU::instructions[0xF2] = { "SBC", ZeroPage, 2, 5, false, opcodes::SBC };
-
-
-    cpu::CPU::instructions[0x38] = { "SEC", Implicit, 1, 2, false, opcodes::SEC };
-    cpu::CPU::instructions[0xF8] = { "SED", Implicit, 1, 2, false, opcodes::SED };
-    cpu::CPU::instructions[0x78] = { "SEI", Implicit, 1, 2, false, opcodes::SEI };
-
-    cpu::CPU::instructions[0x85] = { "STA", ZeroPage, 2, 2, false, opcodes::STA };
-    cpu::CPU::instructions[0x95] = { "STA", ZeroPageX, 2, 4, false, opcodes::STA };
-    cpu::CPU::instructions[0x8D] = { "STA", Absolute, 3, 4, false, opcodes::STA };
-    cpu::CPU::instructions[0x9D] = { "STA", AbsoluteX, 3, 5, false, opcodes::STA };
-    cpu::CPU::instructions[0x99] = { "STA", AbsoluteY, 3, 5, false, opcodes::STA };
-    cpu::CPU::instructions[0x81] = { "STA", IdxIndirect, 2, 6, false, opcodes::STA };
-    cpu::CPU::instructions[0x91] = { "STA", IndirectIdx, 2, 6, false, opcodes::STA };
-
-    cpu::CPU::instructions[0x86] = { "STX", ZeroPage, 2, 3, false, opcodes::STX };
-    cpu::CPU::instructions[0x96] = { "STX", ZeroPageY, 2, 4, false, opcodes::STX };
-    cpu::CPU::instructions[0x8E] = { "STX", Absolute, 3, 4, false, opcodes::STX };
-
-    cpu::CPU::instructions[0x84] = { "STY", ZeroPage, 2, 3, false, opcodes::STY };
-    cpu::CPU::instructions[0x94] = { "STY", ZeroPageY, 2, 4, false, opcodes::STY };
-    cpu::CPU::instructions[0x8C] = { "STY", Absolute, 3, 4, false, opcodes::STY };
-
-    cpu::CPU::instructions[0xAA] = { "TAX", Implicit, 1, 2, false, opcodes::TAX };
-    cpu::CPU::instructions[0xA8] = { "TAY", Implicit, 1, 2, false, opcodes::TAY };
-    cpu::CPU::instructions[0xBA] = { "TSX", Implicit, 1, 2, false, opcodes::TSX };
-    cpu::CPU::instructions[0x8A] = { "TXA", Implicit, 1, 2, false, opcodes::TXA };
-    cpu::CPU::instructions[0x9A] = { "TXS", Implicit, 1, 2, false, opcodes::TXS };
-    cpu::CPU::instructions[0x98] = { "TYA", Implicit, 1, 2, false, opcodes::TYA };
-
-    cpu::CPU::instructions[0xA3] = { "LAX", IdxIndirect, 2, 6, false, opcodes::LAX };
-    cpu::CPU::instructions[0xA7] = { "LAX", ZeroPage, 2, 3, false, opcodes::LAX };
-    cpu::CPU::instructions[0xB7] = { "LAX", ZeroPageY, 2, 4, false, opcodes::LAX };
-    cpu::CPU::instructions[0xAF] = { "LAX", Absolute, 3, 4, false, opcodes::LAX };
-    cpu::CPU::instructions[0xBF] = { "LAX", AbsoluteY, 3, 4, false, opcodes::LAX };
-    cpu::CPU::instructions[0xB3] = { "LAX", IndirectIdx, 2, 5, false, opcodes::LAX };
-
-    cpu::CPU::instructions[0x87] = { "SAX", ZeroPage, 2, 3, false, opcodes::SAX };
-    cpu::CPU::instructions[0x97] = { "SAX", ZeroPageY, 2, 4, false, opcodes::SAX };
-    cpu::CPU::instructions[0x8F] = { "SAX", Absolute, 3, 4, false, opcodes::SAX };
-    cpu::CPU::instructions[0x83] = { "SAX", IdxIndirect, 2, 6, false, opcodes::SAX };
-
-    cpu::CPU::instructions[0xEB] = { "USBC", Immediate, 2, 6, false, opcodes::SBC };
-
-    cpu::CPU::instructions[0xC7] = { "DCP", ZeroPage, 2, 5, false, opcodes::DCP };
-    cpu::CPU::instructions[0xD7] = { "DCP", ZeroPageX, 2, 6, false, opcodes::DCP };
-    cpu::CPU::instructions[0xCF] = { "DCP", Absolute, 3, 6, false, opcodes::DCP };
-    cpu::CPU::instructions[0xDF] = { "DCP", AbsoluteX, 3, 7, false, opcodes::DCP };
-    cpu::CPU::instructions[0xDB] = { "DCP", AbsoluteY, 3, 7, false, opcodes::DCP };
-    cpu::CPU::instructions[0xC3] = { "DCP", IdxIndirect, 2, 8, false, opcodes::DCP };
-    cpu::CPU::instructions[0xD3] = { "DCP", IndirectIdx, 2, 8, false, opcodes::DCP };
-
-    cpu::CPU::instructions[0xE7] = { "ISC", ZeroPage, 2, 5, false, opcodes::ISC };
-    cpu::CPU::instructions[0xF7] = { "ISC", ZeroPageX, 2, 6, false, opcodes::ISC };
-    cpu::CPU::instructions[0xEF] = { "ISC", Absolute, 3, 6, false, opcodes::ISC };
-    cpu::CPU::instructions[0xFF] = { "ISC", AbsoluteX, 3, 7, false, opcodes::ISC };
-    cpu::CPU::instructions[0xFB] = { "ISC", AbsoluteY, 3, 7, false, opcodes::ISC };
-    cpu::CPU::instructions[0xE3] = { "ISC", IdxIndirect, 2, 8, false, opcodes::ISC };
-    cpu::CPU::instructions[0xF3] = { "ISC", IndirectIdx, 2, 8, false, opcodes::ISC };
-
-    cpu::CPU::instructions[0x07] = { "SLO", ZeroPage, 2, 5, false, opcodes::SLO };
-    cpu::CPU::instructions[0x17] = { "SLO", ZeroPageX, 2, 6, false, opcodes::SLO };
-    cpu::CPU::instructions[0x0F] = { "SLO", Absolute, 3, 6, false, opcodes::SLO };
-    cpu::CPU::instructions[0x1F] = { "SLO", AbsoluteX, 3, 7, false, opcodes::SLO };
-    cpu::CPU::instructions[0x1B] = { "SLO", AbsoluteY, 3, 7, false, opcodes::SLO };
-    cpu::CPU::instructions[0x03] = { "SLO", IdxIndirect, 2, 8, false, opcodes::SLO };
-    cpu::CPU::instructions[0x13] = { "SLO", IndirectIdx, 2, 8, false, opcodes::SLO };
-
-    cpu::CPU::instructions[0x27] = { "RLA", ZeroPage, 2, 5, false, opcodes::RLA };
-    cpu::CPU::instructions[0x37] = { "RLA", ZeroPageX, 2, 6, false, opcodes::RLA };
-    cpu::CPU::instructions[0x2F] = { "RLA", Absolute, 3, 6, false, opcodes::RLA };
-    cpu::CPU::instructions[0x3F] = { "RLA", AbsoluteX, 3, 7, false, opcodes::RLA };
-    cpu::CPU::instructions[0x3B] = { "RLA", AbsoluteY, 3, 7, false, opcodes::RLA };
-    cpu::CPU::instructions[0x23] = { "RLA", IdxIndirect, 2, 8, false, opcodes::RLA };
-    cpu::CPU::instructions[0x33] = { "RLA", IndirectIdx, 2, 8, false, opcodes::RLA };
-
-    cpu::CPU::instructions[0x47] = { "SRE", ZeroPage, 2, 5, false, opcodes::SRE };
-    cpu::CPU::instructions[0x57] = { "SRE", ZeroPageX, 2, 6, false, opcodes::SRE };
-    cpu::CPU::instructions[0x4F] = { "SRE", Absolute, 3, 6, false, opcodes::SRE };
-    cpu::CPU::instructions[0x5F] = { "SRE", AbsoluteX, 3, 7, false, opcodes::SRE };
-    cpu::CPU::instructions[0x5B] = { "SRE", AbsoluteY, 3, 7, false, opcodes::SRE };
-    cpu::CPU::instructions[0x43] = { "SRE", IdxIndirect, 2, 8, false, opcodes::SRE };
-    cpu::CPU::instructions[0x53] = { "SRE", IndirectIdx, 2, 8, false, opcodes::SRE };
-
-    cpu::CPU::instructions[0x67] = { "RRA", ZeroPage, 2, 5, false, opcodes::RRA };
-    cpu::CPU::instructions[0x77] = { "RRA", ZeroPageX, 2, 6, false, opcodes::RRA };
-    cpu::CPU::instructions[0x6F] = { "RRA", Absolute, 3, 6, false, opcodes::RRA };
-    cpu::CPU::instructions[0x7F] = { "RRA", AbsoluteX, 3, 7, false, opcodes::RRA };
-    cpu::CPU::instructions[0x7B] = { "RRA", AbsoluteY, 3, 7, false, opcodes::RRA };
-    cpu::CPU::instructions[0x63] = { "RRA", IdxIndirect, 2, 8, false, opcodes::RRA };
-    cpu::CPU::instructions[0x73] = { "RRA", IndirectIdx, 2, 8, false, opcodes::RRA };
-}
-
-CPU* cpu::initialize()
-{
-    CPU* c = new CPU();
-    c->A = 0;
-    c->X = 0;
-    c->Y = 0;
-    c->SP = 0xFD;
-    c->PS = 0;
-    c->PC = 0;
-
-    c->setFlag(CPU::I, 0x1);
-
-    c->populate();
-
-    return c;
+// whether page crossings and taken branches add cycles: branches, and indexed modes on instructions
+// that only read their operand. stores and read-modify-write always take the extra cycle, it's in their base count
+static constexpr bool penalized(void (*impl)(CPU&, CPU::addressingMode), CPU::addressingMode mode)
+{
+    if (mode == CPU::Relative)
+        return true;
+
+    if (mode != CPU::AbsoluteX && mode != CPU::AbsoluteY && mode != CPU::IndirectIdx)
+        return false;
+
+    return impl == opcodes::ADC || impl == opcodes::AND || impl == opcodes::CMP || impl == opcodes::EOR ||
+        impl == opcodes::LDA || impl == opcodes::LDX || impl == opcodes::LDY || impl == opcodes::ORA ||
+        impl == opcodes::SBC || impl == opcodes::LAX || impl == opcodes::NOP;
+}
+
+// build the opcode table from the shared list, runs at compile time
+static constexpr std::array<CPU::instruction, 256> buildInstructions()
+{
+    std::array<CPU::instruction, 256> table = {};
+
+#define OPCODE(op, name, impl, mode, size, cycles, incrementPc) \
+    table[op] = { name, CPU::mode, size, cycles, incrementPc, penalized(opcodes::impl, CPU::mode), opcodes::impl };
+#include "../headers/cpu/opcodes.def"
+
+    return table;
+}
+
+const std::array<CPU::instruction, 256> CPU::instructions = buildInstructions();
+
+void cpu::initialize(CPU& c)
+{
+    c.A = 0;
+    c.X = 0;
+    c.Y = 0;
+    c.SP = 0xFD;
+    c.PS = 0;
+    c.PC = 0;
+    c.cycles = 0;
+    c.penalty = 0;
+
+    c.setFlag(CPU::I, 0x1);
+}
+
+// switch core: every case calls its handler with a constant addressing mode, since the handlers
+// and resolve() live in this file the compiler inlines them and folds the mode switch away
+CPU_FLATTEN uint8_t cpu::stepSwitch(CPU& c)
+{
+    switch (c.bus->read(c.PC))
+    {
+#define OPCODE(op, name, impl, mode, size, cycles, incrementPc) \
+    case op: \
+    { \
+        constexpr bool extra = penalized(opcodes::impl, CPU::mode); \
+        opcodes::impl(c, CPU::mode); \
+        if (!incrementPc) \
+            c.PC += size; \
+        return cycles + (extra ? c.penalty : 0); \
+    }
+#include "../headers/cpu/opcodes.def"
+    default:
+        return 0;
+    }
 }
\ No newline at end of file
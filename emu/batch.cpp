@@ -0,0 +1,163 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    batch.cpp - run many ROMs in parallel on a work stealing pool
+*/
+
+#include "../headers/emu/batch.h"
+#include "../headers/emu/system.h"
+#include "../headers/rom/rom.h"
+#include <algorithm>
+#include <cctype>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace emu
+{
+    // one per worker. the owner takes from the back, thieves from the front,
+    // so they only ever meet on the last job in the queue
+    struct queue
+    {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+
+        bool pop(size_t& job)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (jobs.empty())
+                return false;
+            job = jobs.back();
+            jobs.pop_back();
+            return true;
+        }
+
+        bool steal(size_t& job)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (jobs.empty())
+                return false;
+            job = jobs.front();
+            jobs.pop_front();
+            return true;
+        }
+    };
+
+    static batchResult runOne(const std::string& path, const limits& l, uint8_t (*core)(cpu::CPU&))
+    {
+        batchResult r = {};
+        r.path = path;
+
+        // a Console is too big for the worker's stack
+        Console* console = new Console();
+
+        std::shared_ptr<const rom::Image> image = rom::load(path.c_str());
+        r.loaded = image != nullptr;
+        r.supported = r.loaded && rom::insert(*console, std::move(image));
+        if (r.supported)
+        {
+            cpu::CPU& c = console->cpu;
+            c.PS = 0x24;
+            c.PC = console->bus.read(0xFFFC) | (console->bus.read(0xFFFD) << 8);
+
+            r.run = runHeadless(*console, l, core);
+        }
+
+        delete console;
+        return r;
+    }
+
+    std::vector<std::string> batchList(const char* path)
+    {
+        std::vector<std::string> roms;
+        std::error_code error;
+
+        if (fs::is_directory(path, error))
+        {
+            for (const fs::directory_entry& entry : fs::directory_iterator(path, error))
+            {
+                std::string ext = entry.path().extension().string();
+                std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char ch) { return (char)tolower(ch); });
+
+                if (entry.is_regular_file(error) && ext == ".nes")
+                    roms.push_back(entry.path().string());
+            }
+
+            std::sort(roms.begin(), roms.end());
+            return roms;
+        }
+
+        std::ifstream manifest(path);
+        const fs::path base = fs::path(path).parent_path();
+        std::string line;
+
+        while (std::getline(manifest, line))
+        {
+            // trim, manifests written on windows keep their \r
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            line.erase(0, line.find_first_not_of(" \t"));
+
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            fs::path rom(line);
+            roms.push_back(rom.is_relative() ? (base / rom).string() : line);
+        }
+
+        return roms;
+    }
+
+    std::vector<batchResult> runBatch(const std::vector<std::string>& roms, const limits& l, unsigned threads,
+        uint8_t (*core)(cpu::CPU&))
+    {
+        std::vector<batchResult> results(roms.size());
+
+        if (!threads)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        if (threads > roms.size())
+            threads = static_cast<unsigned>(std::max<size_t>(1, roms.size()));
+
+        // deal the ROMs out round robin, neighbours in a directory tend to take similar time
+        std::vector<queue> queues(threads);
+        for (size_t i = 0; i < roms.size(); i++)
+            queues[i % threads].jobs.push_back(i);
+
+        auto worker = [&](unsigned self)
+        {
+            size_t job;
+
+            for (;;)
+            {
+                bool found = queues[self].pop(job);
+
+                // nothing left here, go through everyone else once. no job ever spawns another,
+                // so when every queue is empty the batch is done
+                for (unsigned i = 1; !found && i < threads; i++)
+                    found = queues[(self + i) % threads].steal(job);
+
+                if (!found)
+                    return;
+
+                // every job writes its own slot, nothing to lock
+                results[job] = runOne(roms[job], l, core);
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; i++)
+            pool.emplace_back(worker, i);
+
+        // the calling thread works too
+        worker(0);
+
+        for (std::thread& t : pool)
+            t.join();
+
+        return results;
+    }
+}
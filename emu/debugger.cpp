@@ -0,0 +1,559 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    debugger.cpp - breakpoints, watchpoints, conditions and stepping
+*/
+
+#include "../headers/emu/debugger.h"
+#include "../headers/emu/system.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+namespace emu
+{
+    enum opKind : uint8_t
+    {
+        Constant,
+        RegA,
+        RegX,
+        RegY,
+        RegSP,
+        RegPC,
+        RegP,
+        Address, // of the access being checked
+        Value, // the byte read or written, the opcode for exec
+        Deref,
+        Not,
+        Negate,
+        Complement,
+        Mul,
+        Div,
+        Mod,
+        Add,
+        Sub,
+        And,
+        Xor,
+        Or,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+        NotEqual,
+        LogicalAnd,
+        LogicalOr
+    };
+
+    // evaluation stack, deeper expressions are refused when they're compiled
+    static const int STACK = 32;
+
+    struct binaryOp
+    {
+        const char* text;
+        opKind kind;
+        int precedence;
+    };
+
+    // two character operators before their one character prefixes
+    static const binaryOp BINARY[] =
+    {
+        { "||", LogicalOr, 1 },
+        { "&&", LogicalAnd, 2 },
+        { "|", Or, 3 },
+        { "^", Xor, 4 },
+        { "&", And, 5 },
+        { "==", Equal, 6 },
+        { "!=", NotEqual, 6 },
+        { "<=", LessEqual, 7 },
+        { ">=", GreaterEqual, 7 },
+        { "<", Less, 7 },
+        { ">", Greater, 7 },
+        { "+", Add, 8 },
+        { "-", Sub, 8 },
+        { "*", Mul, 9 },
+        { "/", Div, 9 },
+        { "%", Mod, 9 }
+    };
+
+    struct name
+    {
+        const char* text;
+        opKind kind;
+    };
+
+    static const name NAMES[] =
+    {
+        { "a", RegA },
+        { "x", RegX },
+        { "y", RegY },
+        { "sp", RegSP },
+        { "pc", RegPC },
+        { "p", RegP },
+        { "addr", Address },
+        { "value", Value }
+    };
+
+    // precedence climbing straight into reverse polish
+    struct parser
+    {
+        const char* p;
+        std::vector<condition::op>& out;
+        std::string& error;
+
+        void space()
+        {
+            while (isspace(static_cast<unsigned char>(*p)))
+                p++;
+        }
+
+        bool fail(const char* message)
+        {
+            if (error.empty())
+                error = message;
+            return false;
+        }
+
+        void emit(opKind kind, int64_t value = 0)
+        {
+            out.push_back({ kind, value });
+        }
+
+        bool number(int base)
+        {
+            char* end;
+            const long long v = strtoll(p, &end, base);
+            if (end == p)
+                return fail("expected a number");
+            p = end;
+            emit(Constant, v);
+            return true;
+        }
+
+        bool primary()
+        {
+            space();
+
+            if (*p == '(' || *p == '[')
+            {
+                const char close = *p == '(' ? ')' : ']';
+                p++;
+                if (!expression(1))
+                    return false;
+                space();
+                if (*p != close)
+                    return fail(close == ')' ? "missing )" : "missing ]");
+                p++;
+                if (close == ']')
+                    emit(Deref);
+                return true;
+            }
+
+            if (*p == '$')
+            {
+                p++;
+                return number(16);
+            }
+
+            if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+            {
+                p += 2;
+                return number(16);
+            }
+
+            if (isdigit(static_cast<unsigned char>(*p)))
+                return number(10);
+
+            if (isalpha(static_cast<unsigned char>(*p)))
+            {
+                std::string word;
+                while (isalnum(static_cast<unsigned char>(*p)))
+                    word += static_cast<char>(tolower(static_cast<unsigned char>(*p++)));
+
+                for (const name& n : NAMES)
+                {
+                    if (word == n.text)
+                    {
+                        emit(n.kind);
+                        return true;
+                    }
+                }
+                return fail("unknown name");
+            }
+
+            return fail("expected a value");
+        }
+
+        bool unary()
+        {
+            space();
+
+            opKind kind;
+            if (*p == '!' && p[1] != '=')
+                kind = Not;
+            else if (*p == '-')
+                kind = Negate;
+            else if (*p == '~')
+                kind = Complement;
+            else
+                return primary();
+
+            p++;
+            if (!unary())
+                return false;
+            emit(kind);
+            return true;
+        }
+
+        bool expression(int minPrecedence)
+        {
+            if (!unary())
+                return false;
+
+            for (;;)
+            {
+                space();
+
+                const binaryOp* match = nullptr;
+                for (const binaryOp& b : BINARY)
+                {
+                    if (!strncmp(p, b.text, strlen(b.text)))
+                    {
+                        match = &b;
+                        break;
+                    }
+                }
+
+                if (!match || match->precedence < minPrecedence)
+                    return true;
+
+                p += strlen(match->text);
+                if (!expression(match->precedence + 1))
+                    return false;
+                emit(match->kind);
+            }
+        }
+    };
+
+    bool condition::compile(const std::string& text, std::string& error)
+    {
+        code.clear();
+        error.clear();
+
+        parser parse = { text.c_str(), code, error };
+        parse.space();
+        if (!*parse.p)
+            return true;
+
+        if (!parse.expression(1))
+        {
+            code.clear();
+            return false;
+        }
+
+        parse.space();
+        if (*parse.p)
+        {
+            code.clear();
+            error = "unexpected text after the expression";
+            return false;
+        }
+
+        // the stack is fixed, measure what this one needs
+        int depth = 0;
+        for (const op& o : code)
+        {
+            if (o.kind <= Value)
+                depth++;
+            else if (o.kind >= Mul)
+                depth--;
+
+            if (depth > STACK)
+            {
+                code.clear();
+                error = "expression too deep";
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    int64_t condition::evaluate(const Console& console, uint16_t addr, uint8_t value) const
+    {
+        if (code.empty())
+            return 1;
+
+        const cpu::CPU& c = console.cpu;
+        int64_t stack[STACK];
+        int top = 0;
+
+        for (const op& o : code)
+        {
+            // binary operators take the top two, b is the right hand side
+            int64_t b = 0;
+            if (o.kind >= Mul)
+                b = stack[--top];
+            int64_t& a = stack[o.kind <= Value ? top++ : top - 1];
+
+            switch (o.kind)
+            {
+            case Constant: a = o.value; break;
+            case RegA: a = c.A; break;
+            case RegX: a = c.X; break;
+            case RegY: a = c.Y; break;
+            case RegSP: a = c.SP; break;
+            case RegPC: a = c.PC; break;
+            case RegP: a = c.PS; break;
+            case Address: a = addr; break;
+            case Value: a = value; break;
+            case Deref: a = console.bus.peek(static_cast<uint16_t>(a)); break;
+            case Not: a = !a; break;
+            case Negate: a = -a; break;
+            case Complement: a = ~a; break;
+            case Mul: a *= b; break;
+            case Div: a = b ? a / b : 0; break;
+            case Mod: a = b ? a % b : 0; break;
+            case Add: a += b; break;
+            case Sub: a -= b; break;
+            case And: a &= b; break;
+            case Xor: a ^= b; break;
+            case Or: a |= b; break;
+            case Less: a = a < b; break;
+            case LessEqual: a = a <= b; break;
+            case Greater: a = a > b; break;
+            case GreaterEqual: a = a >= b; break;
+            case Equal: a = a == b; break;
+            case NotEqual: a = a != b; break;
+            case LogicalAnd: a = a && b; break;
+            case LogicalOr: a = a || b; break;
+            }
+        }
+
+        return stack[0];
+    }
+
+    void Debugger::attach(Console& c)
+    {
+        console = &c;
+        c.debugger = this;
+        rebuild();
+    }
+
+    void Debugger::detach()
+    {
+        if (!console)
+            return;
+
+        const uint64_t none[4] = {};
+        console->bus.watch(none, none);
+        console->debugger = nullptr;
+        console = nullptr;
+    }
+
+    bool Debugger::add(uint16_t first, uint16_t last, uint8_t access, const std::string& text, std::string& error)
+    {
+        breakpoint b = {};
+        if (!b.when.compile(text, error))
+            return false;
+
+        b.first = first < last ? first : last;
+        b.last = first < last ? last : first;
+        b.access = access;
+        b.enabled = true;
+        b.text = text;
+
+        points.push_back(b);
+        rebuild();
+        return true;
+    }
+
+    void Debugger::remove(size_t i)
+    {
+        if (i >= points.size())
+            return;
+        points.erase(points.begin() + i);
+        rebuild();
+    }
+
+    void Debugger::enable(size_t i, bool enabled)
+    {
+        if (i >= points.size())
+            return;
+        points[i].enabled = enabled;
+        rebuild();
+    }
+
+    void Debugger::clear()
+    {
+        points.clear();
+        rebuild();
+    }
+
+    void Debugger::stepOver()
+    {
+        const cpu::CPU& c = console->cpu;
+
+        // only JSR goes anywhere it comes back from, everything else is a plain step
+        if (console->bus.peek(c.PC) == 0x20)
+        {
+            stepping = Over;
+            stepTarget = static_cast<uint16_t>(c.PC + 3);
+            stepStack = c.SP;
+        }
+        else
+            stepping = Next;
+
+        rebuild();
+    }
+
+    void Debugger::stepOut()
+    {
+        stepping = Out;
+        stepStack = console->cpu.SP;
+        rebuild();
+    }
+
+    void Debugger::resume()
+    {
+        skip = true;
+        hit = false;
+        reason = NotStopped;
+    }
+
+    bool Debugger::beforeInstruction()
+    {
+        const cpu::CPU& c = console->cpu;
+
+        // a watchpoint went off during the last instruction, stop after it
+        if (hit)
+        {
+            hit = false;
+            return true;
+        }
+
+        const uint8_t opcode = console->bus.peek(c.PC);
+        const uint8_t previous = lastOpcode;
+        lastOpcode = opcode;
+
+        if (skip)
+        {
+            skip = false;
+            return false;
+        }
+
+        if (stepping != None)
+        {
+            // a recursive call comes back through the same address deeper in the stack, that one doesn't count
+            const bool done = stepping == Next ||
+                (stepping == Over && c.PC == stepTarget && c.SP >= stepStack) ||
+                (stepping == Out && (previous == 0x60 || previous == 0x40) && c.SP > stepStack);
+
+            if (done)
+            {
+                stepping = None;
+                rebuild();
+                reason = StepDone;
+                hitAddress = c.PC;
+                hitAccess = Exec;
+                return true;
+            }
+        }
+
+        if (!((execPages[c.PC >> 14] >> ((c.PC >> 8) & 63)) & 1))
+            return false;
+
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            if (matches(points[i], c.PC, opcode, Exec))
+            {
+                stop(i, c.PC, opcode, Exec);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void Debugger::access(Console& c, uint16_t addr, uint8_t value, accessType type)
+    {
+        // the first one in an instruction is the one reported
+        if (hit)
+            return;
+
+        // the instruction's own bytes are fetched through the bus too, exec breakpoints are for those
+        if (type == Read && static_cast<uint16_t>(addr - c.cpu.PC) < cpu::CPU::instructions[c.bus.peek(c.cpu.PC)].size)
+            return;
+
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            if (matches(points[i], addr, value, type))
+            {
+                stop(i, addr, value, type);
+                hit = true;
+                return;
+            }
+        }
+    }
+
+    bool Debugger::matches(breakpoint& b, uint16_t addr, uint8_t value, accessType type)
+    {
+        if (!b.enabled || !(b.access & type) || addr < b.first || addr > b.last)
+            return false;
+        if (!b.when.empty() && !b.when.evaluate(*console, addr, value))
+            return false;
+
+        b.hits++;
+        return true;
+    }
+
+    void Debugger::stop(size_t i, uint16_t addr, uint8_t value, accessType type)
+    {
+        reason = Breakpoint;
+        hitIndex = i;
+        hitAddress = addr;
+        hitValue = value;
+        hitAccess = type;
+
+        // a breakpoint inside a step over/out ends the step, continuing after it shouldn't finish it
+        if (stepping != None)
+        {
+            stepping = None;
+            rebuild();
+        }
+    }
+
+    void Debugger::rebuild()
+    {
+        uint64_t read[4] = {};
+        uint64_t write[4] = {};
+        std::fill(execPages, execPages + 4, 0);
+
+        bool any = false;
+        for (const breakpoint& b : points)
+        {
+            if (!b.enabled)
+                continue;
+
+            for (int page = b.first >> 8; page <= b.last >> 8; page++)
+            {
+                const uint64_t bit = 1ull << (page & 63);
+                if (b.access & Exec)
+                    execPages[page >> 6] |= bit;
+                if (b.access & Read)
+                    read[page >> 6] |= bit;
+                if (b.access & Write)
+                    write[page >> 6] |= bit;
+            }
+            any = true;
+        }
+
+        // watchpoints report through hit, which is only looked at while armed
+        armed = any || stepping != None;
+
+        if (console)
+            console->bus.watch(read, write);
+    }
+}
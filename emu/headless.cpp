@@ -0,0 +1,74 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    headless.cpp - run the CPU as fast as possible, no UI
+*/
+
+#include "../headers/emu/headless.h"
+#include "../headers/emu/system.h"
+#include <chrono>
+#include <vector>
+
+namespace emu
+{
+    // the test ROM status protocol, the signature tells a real result apart from whatever is in PRG RAM
+    static bool testFinished(const Console& console)
+    {
+        const std::vector<uint8_t>& ram = console.bus.prgRam;
+        return ram[1] == 0xDE && ram[2] == 0xB0 && ram[3] == 0x61 && ram[0] < 0x80;
+    }
+
+    result runHeadless(Console& console, const limits& l, uint8_t (*core)(cpu::CPU&))
+    {
+        result r = {};
+        r.halt = Completed;
+
+        // turn the frame limit into a cycle limit so the loop only has to check one thing
+        uint64_t maxCycles = l.cycles;
+        if (l.frames && (!maxCycles || l.frames * CYCLES_PER_FRAME < maxCycles))
+            maxCycles = l.frames * CYCLES_PER_FRAME;
+
+        const uint64_t maxInstructions = l.instructions ? l.instructions : UINT64_MAX;
+        if (!maxCycles)
+            maxCycles = UINT64_MAX;
+
+        // with no status to wait for this never comes up
+        uint64_t nextCheck = l.testStatus ? CYCLES_PER_FRAME : UINT64_MAX;
+
+        auto start = std::chrono::steady_clock::now();
+
+        while (r.instructions < maxInstructions && r.cycles < maxCycles)
+        {
+            uint16_t cycles = emu::step(console, core);
+
+            if (!cycles)
+            {
+                r.halt = Unimplemented;
+                break;
+            }
+
+            r.cycles += cycles;
+            r.instructions++;
+
+            if (r.cycles >= nextCheck)
+            {
+                if (testFinished(console))
+                {
+                    r.halt = Finished;
+                    r.status = console.bus.prgRam[0];
+                    break;
+                }
+                nextCheck += CYCLES_PER_FRAME;
+            }
+        }
+
+        auto end = std::chrono::steady_clock::now();
+
+        r.seconds = std::chrono::duration<double>(end - start).count();
+        r.frames = r.cycles / CYCLES_PER_FRAME;
+        r.pc = console.cpu.PC;
+
+        return r;
+    }
+}
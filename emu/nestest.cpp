@@ -0,0 +1,261 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    nestest.cpp - nestest.log formatted lines and a streaming diff against a recorded log
+*/
+
+#include "../headers/emu/nestest.h"
+#include "../headers/emu/system.h"
+#include <algorithm>
+#include <cstring>
+
+namespace emu
+{
+    // the register columns start here, everything before is address, bytes and disassembly
+    static const size_t REGISTERS_COLUMN = 48;
+
+    // read without going through a handler, I/O shows up the way Nintendulator logs it
+    static uint8_t peek(const memory::Bus& bus, uint16_t addr)
+    {
+        const uint8_t* page = bus.readPages[addr >> 8];
+        return page ? page[addr & 0xFF] : 0xFF;
+    }
+
+    static uint16_t peek16(const memory::Bus& bus, uint16_t lo, uint16_t hi)
+    {
+        return peek(bus, lo) | (peek(bus, hi) << 8);
+    }
+
+    // documented opcodes only, everything else gets a * in front of its name
+    static bool unofficial(uint8_t op, const char* name)
+    {
+        static const char* const extra[] = { "LAX", "SAX", "DCP", "ISC", "RLA", "SLO", "SRE", "RRA", "ANC", "USBC" };
+
+        if (!strcmp(name, "NOP"))
+            return op != 0xEA;
+
+        for (const char* e : extra)
+            if (!strcmp(name, e))
+                return true;
+        return false;
+    }
+
+    // our names for unofficial opcodes aren't always the ones the log uses
+    static const char* logName(const char* name)
+    {
+        if (!strcmp(name, "ISC"))
+            return "ISB";
+        if (!strcmp(name, "USBC"))
+            return "SBC";
+        return name;
+    }
+
+    // operand part of the disassembly, with the effective address and the value there before the instruction runs
+    static void operand(Console& console, const cpu::CPU::instruction& instr, uint8_t op, char* buf, size_t len)
+    {
+        const memory::Bus& bus = console.bus;
+        const cpu::CPU& c = console.cpu;
+
+        const uint8_t b1 = peek(bus, c.PC + 1);
+        const uint16_t abs = peek16(bus, c.PC + 1, c.PC + 2);
+        const bool jump = op == 0x4C || op == 0x20; // JMP/JSR absolute show the target only
+
+        switch (instr.mode)
+        {
+        case cpu::CPU::Accumulator:
+            snprintf(buf, len, "A");
+            break;
+        case cpu::CPU::Immediate:
+            snprintf(buf, len, "#$%02X", b1);
+            break;
+        case cpu::CPU::ZeroPage:
+            snprintf(buf, len, "$%02X = %02X", b1, peek(bus, b1));
+            break;
+        case cpu::CPU::ZeroPageX:
+        case cpu::CPU::ZeroPageY:
+        {
+            const bool x = instr.mode == cpu::CPU::ZeroPageX;
+            const uint8_t addr = b1 + (x ? c.X : c.Y);
+            snprintf(buf, len, "$%02X,%c @ %02X = %02X", b1, x ? 'X' : 'Y', addr, peek(bus, addr));
+            break;
+        }
+        case cpu::CPU::Relative:
+            snprintf(buf, len, "$%04X", (uint16_t)(c.PC + 2 + static_cast<int8_t>(b1)));
+            break;
+        case cpu::CPU::Absolute:
+            if (jump)
+                snprintf(buf, len, "$%04X", abs);
+            else
+                snprintf(buf, len, "$%04X = %02X", abs, peek(bus, abs));
+            break;
+        case cpu::CPU::AbsoluteX:
+        case cpu::CPU::AbsoluteY:
+        {
+            const bool x = instr.mode == cpu::CPU::AbsoluteX;
+            const uint16_t addr = abs + (x ? c.X : c.Y);
+            snprintf(buf, len, "$%04X,%c @ %04X = %02X", abs, x ? 'X' : 'Y', addr, peek(bus, addr));
+            break;
+        }
+        case cpu::CPU::Indirect:
+            // the pointer's high byte doesn't carry into the next page
+            snprintf(buf, len, "($%04X) = %04X", abs, peek16(bus, abs, (abs & 0xFF00) | ((abs + 1) & 0x00FF)));
+            break;
+        case cpu::CPU::IdxIndirect:
+        {
+            const uint8_t zp = b1 + c.X;
+            const uint16_t addr = peek16(bus, zp, (uint8_t)(zp + 1));
+            snprintf(buf, len, "($%02X,X) @ %02X = %04X = %02X", b1, zp, addr, peek(bus, addr));
+            break;
+        }
+        case cpu::CPU::IndirectIdx:
+        {
+            const uint16_t base = peek16(bus, b1, (uint8_t)(b1 + 1));
+            const uint16_t addr = base + c.Y;
+            snprintf(buf, len, "($%02X),Y = %04X @ %04X = %02X", b1, base, addr, peek(bus, addr));
+            break;
+        }
+        default:
+            buf[0] = 0;
+            break;
+        }
+    }
+
+    int nestestLine(Console& console, char* buf, size_t len)
+    {
+        const cpu::CPU& c = console.cpu;
+        const uint8_t op = peek(console.bus, c.PC);
+        const cpu::CPU::instruction& instr = cpu::CPU::instructions[op];
+        const int size = instr.impl ? instr.size : 1;
+
+        // "4C F5 C5"
+        char bytes[9] = {};
+        for (int i = 0, at = 0; i < size; i++)
+            at += snprintf(bytes + at, sizeof(bytes) - at, i ? " %02X" : "%02X", peek(console.bus, c.PC + i));
+
+        char args[32];
+        operand(console, instr, op, args, sizeof(args));
+
+        char text[40];
+        if (!instr.impl)
+            snprintf(text, sizeof(text), "???");
+        else
+            snprintf(text, sizeof(text), args[0] ? "%s %s" : "%s", logName(instr.name), args);
+
+        const bool star = instr.impl && unofficial(op, instr.name);
+
+        return snprintf(buf, len, "%04X  %-8s %c%-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%llu",
+            c.PC,
+            bytes,
+            star ? '*' : ' ',
+            text,
+            c.A,
+            c.X,
+            c.Y,
+            c.PS,
+            c.SP,
+            console.ppu.scanline,
+            console.ppu.dot,
+            (unsigned long long)c.cycles);
+    }
+
+    // lines compare equal, optionally skipping the disassembly
+    static bool same(const char* expected, size_t length, const char* got, bool registers)
+    {
+        const size_t n = strlen(got);
+
+        if (!registers)
+            return n == length && !memcmp(expected, got, n);
+
+        // address and opcode bytes, then everything from A: on
+        return n >= REGISTERS_COLUMN && length >= REGISTERS_COLUMN &&
+            !memcmp(expected, got, 15) &&
+            n - REGISTERS_COLUMN == length - REGISTERS_COLUMN &&
+            !memcmp(expected + REGISTERS_COLUMN, got + REGISTERS_COLUMN, n - REGISTERS_COLUMN);
+    }
+
+    nestestResult runNestest(Console& console, const char* golden, size_t goldenSize, const nestestOptions& o, FILE* out)
+    {
+        nestestResult r = {};
+        cpu::CPU& c = console.cpu;
+
+        // automated mode, entered the way the log was recorded: RAM cleared, 7 cycles of reset already behind us
+        std::fill(console.bus.internal.begin(), console.bus.internal.end(), 0x00);
+        c.PC = 0xC000;
+        c.PS = 0x24;
+        c.SP = 0xFD;
+        c.cycles = 7;
+        console.sync();
+
+        // the last few matching lines, as offsets into golden
+        const size_t contextSize = 16;
+        const size_t keep = o.context < contextSize ? o.context : contextSize;
+        size_t recent[contextSize];
+
+        const char* end = golden + goldenSize;
+        const char* line = golden;
+        char got[128];
+
+        while (line < end && (!o.lines || r.lines < o.lines))
+        {
+            const char* next = static_cast<const char*>(memchr(line, '\n', end - line));
+            if (!next)
+                next = end;
+
+            size_t length = next - line;
+            if (length && line[length - 1] == '\r')
+                length--;
+
+            // the PPU is lazy, bring it to this instruction so its column is right
+            console.sync();
+            nestestLine(console, got, sizeof(got));
+
+            if (!same(line, length, got, o.registers))
+            {
+                const size_t shown = r.lines < keep ? r.lines : keep;
+                fprintf(out, "[ernesto] - nestest diverged at line %zu\n", r.lines + 1);
+
+                for (size_t i = r.lines - shown; i < r.lines; i++)
+                {
+                    const char* l = golden + recent[i % contextSize];
+                    const char* e = static_cast<const char*>(memchr(l, '\n', end - l));
+                    size_t n = (e ? e : end) - l;
+                    if (n && l[n - 1] == '\r')
+                        n--;
+                    fprintf(out, "  %.*s\n", (int)n, l);
+                }
+
+                fprintf(out, "- %.*s\n+ %s\n", (int)length, line, got);
+                return r;
+            }
+
+            if (!emu::step(console))
+            {
+                fprintf(out, "[ernesto] - nestest hit an unimplemented opcode at line %zu\n%s\n", r.lines + 1, got);
+                return r;
+            }
+
+            recent[r.lines % contextSize] = line - golden;
+            r.lines++;
+
+            line = next + 1;
+
+            // trailing newline, nothing after it
+            if (line >= end || (end - line == 1 && *line == '\r'))
+                break;
+        }
+
+        // after a whole run nestest's own verdict has to agree, error codes for the official opcodes end up
+        // in 0x10 and for the unofficial ones in 0x11, 0 when everything passed
+        r.official = console.bus.internal[0x10];
+        r.unofficial = console.bus.internal[0x11];
+        if (!o.lines && (r.official || r.unofficial))
+        {
+            fprintf(out, "[ernesto] - nestest reported errors: official %02X, unofficial %02X\n", r.official, r.unofficial);
+            return r;
+        }
+
+        r.passed = true;
+        return r;
+    }
+}
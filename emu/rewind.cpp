@@ -0,0 +1,169 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    rewind.cpp - XOR + RLE delta history of save states
+*/
+
+#include "../headers/emu/rewind.h"
+#include "../headers/emu/state.h"
+#include <cstring>
+
+namespace emu
+{
+    // delta encoding: runs of [uint16 unchanged][uint16 changed][changed bytes XORed], until the end of the state
+    static size_t encode(const uint8_t* a, const uint8_t* b, size_t n, uint8_t* out)
+    {
+        uint8_t* p = out;
+        size_t i = 0;
+
+        while (i < n)
+        {
+            uint16_t same = 0;
+            while (i < n && a[i] == b[i] && same < 0xFFFF)
+            {
+                same++;
+                i++;
+            }
+
+            uint16_t changed = 0;
+            uint8_t* run = p + 4;
+            while (i < n && a[i] != b[i] && changed < 0xFFFF)
+            {
+                run[changed++] = a[i] ^ b[i];
+                i++;
+            }
+
+            memcpy(p, &same, 2);
+            memcpy(p + 2, &changed, 2);
+            p = run + changed;
+        }
+
+        return p - out;
+    }
+
+    static void apply(uint8_t* state, const uint8_t* delta, size_t length)
+    {
+        const uint8_t* end = delta + length;
+        size_t i = 0;
+
+        while (delta < end)
+        {
+            uint16_t same, changed;
+            memcpy(&same, delta, 2);
+            memcpy(&changed, delta + 2, 2);
+            delta += 4;
+
+            i += same;
+            for (uint16_t k = 0; k < changed; k++)
+                state[i++] ^= *delta++;
+        }
+    }
+
+    rewind::rewind(size_t frames, size_t capacity)
+        : ring(capacity), records(frames)
+    {
+        clear();
+    }
+
+    void rewind::clear()
+    {
+        first = 0;
+        count = 0;
+        head = 0;
+        bytes = 0;
+        current.clear();
+    }
+
+    size_t rewind::size() const
+    {
+        return count;
+    }
+
+    size_t rewind::used() const
+    {
+        return bytes;
+    }
+
+    void rewind::dropOldest()
+    {
+        bytes -= records[first].length;
+        first = (first + 1) % records.size();
+        count--;
+    }
+
+    size_t rewind::reserve(size_t n)
+    {
+        size_t at = head;
+
+        if (at + n > ring.size())
+        {
+            // no room before the end, whatever is stored past head is the oldest history, drop it and wrap
+            while (count && records[first].offset >= head)
+                dropOldest();
+            at = 0;
+        }
+
+        // the oldest deltas sit right after the newest one, drop the ones we're about to overwrite
+        while (count && records[first].offset >= at && records[first].offset < at + n)
+            dropOldest();
+
+        return at;
+    }
+
+    void rewind::push(Console& console)
+    {
+        const size_t length = stateSize(console);
+
+        // first push (or another cartridge), start over with a full state
+        if (current.size() != length)
+        {
+            clear();
+            current.resize(length);
+            next.resize(length);
+            scratch.resize(length * 3 + 4); // worst case, every other byte changed
+            saveState(console, current.data(), length);
+            return;
+        }
+
+        saveState(console, next.data(), length);
+
+        // delta that takes the new state back to the previous one
+        const size_t n = encode(current.data(), next.data(), length, scratch.data());
+        current.swap(next);
+
+        if (n > ring.size())
+        {
+            // can't keep even one frame of history with a ring this small
+            first = count = head = bytes = 0;
+            return;
+        }
+
+        if (count == records.size())
+            dropOldest();
+
+        const size_t at = reserve(n);
+        memcpy(ring.data() + at, scratch.data(), n);
+
+        records[(first + count) % records.size()] = { at, n };
+        count++;
+        head = at + n;
+        bytes += n;
+    }
+
+    bool rewind::step(Console& console)
+    {
+        if (!count)
+            return false;
+
+        // undo the newest delta, current becomes the frame before it
+        const record& r = records[(first + count - 1) % records.size()];
+        apply(current.data(), ring.data() + r.offset, r.length);
+
+        count--;
+        bytes -= r.length;
+        head = r.offset;
+
+        return loadState(console, current.data(), current.size());
+    }
+}
@@ -0,0 +1,132 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    state.cpp - save states into caller owned buffers
+*/
+
+#include "../headers/emu/state.h"
+#include "../headers/emu/system.h"
+#include "../headers/gfx/tiles.h"
+
+namespace emu
+{
+    struct header
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t flags;
+        uint32_t size; // whole state, header included
+        uint32_t prgSize; // cheap check that the state belongs to this cartridge
+        uint32_t chrSize;
+    };
+
+    static header makeHeader(Console& console, size_t size)
+    {
+        header h = {};
+        h.magic = STATE_MAGIC;
+        h.version = STATE_VERSION;
+        h.size = static_cast<uint32_t>(size);
+        h.prgSize = static_cast<uint32_t>(console.bus.prg.size());
+        h.chrSize = static_cast<uint32_t>(console.bus.chr.size());
+        return h;
+    }
+
+    // everything after the header, in order. bump STATE_VERSION when this changes
+    static void transfer(stream& s, Console& console)
+    {
+        cpu::CPU& c = console.cpu;
+        ppu::PPU& p = console.ppu;
+        rom::Mapper* mapper = console.mapper;
+
+        // CPU
+        s.value(c.A);
+        s.value(c.X);
+        s.value(c.Y);
+        s.value(c.SP);
+        s.value(c.PS);
+        s.value(c.PC);
+        s.value(c.cycles);
+        s.value(c.penalty);
+
+        // memory, PRG/CHR ROM never change so they're left out
+        s.bytes(console.bus.internal.data(), console.bus.internal.size());
+        s.bytes(console.bus.apu.data(), console.bus.apu.size());
+        s.bytes(console.bus.prgRam.data(), console.bus.prgRam.size());
+        if (mapper && mapper->chrWritable)
+            s.bytes(console.bus.chrRam.data(), console.bus.chrRam.size());
+
+        // PPU, the framebuffer gets redrawn within a frame anyway
+        s.value(p.regs);
+        s.bytes(p.vram, sizeof(p.vram));
+        s.bytes(p.oam, sizeof(p.oam));
+        s.bytes(p.palette, sizeof(p.palette));
+        s.value(p.scanline);
+        s.value(p.dot);
+        s.value(p.frame);
+        s.value(p.nmi);
+
+        // APU, its synthesis buffers are host side and start over after a load
+        console.apu.state(s);
+
+        // mapper, last so it can re-apply its banks once its registers are back
+        if (mapper)
+        {
+            s.value(mapper->mirror);
+            s.value(mapper->irq);
+            s.value(mapper->scanlineIrq);
+            mapper->state(s);
+        }
+    }
+
+    size_t stateSize(Console& console)
+    {
+        stream s = { nullptr, 0, 0, false, true };
+        header h = makeHeader(console, 0);
+        s.value(h);
+        transfer(s, console);
+        return s.used;
+    }
+
+    size_t saveState(Console& console, uint8_t* buffer, size_t size)
+    {
+        const size_t total = stateSize(console);
+        if (!buffer || size < total)
+            return 0;
+
+        // the PPU runs lazily, snapshot it at the same point as the CPU
+        console.sync();
+
+        stream s = { buffer, size, 0, false, true };
+        header h = makeHeader(console, total);
+        s.value(h);
+        transfer(s, console);
+
+        return s.ok ? s.used : 0;
+    }
+
+    bool loadState(Console& console, const uint8_t* buffer, size_t size)
+    {
+        header h;
+        if (!buffer || size < sizeof(h))
+            return false;
+
+        memcpy(&h, buffer, sizeof(h));
+
+        // validate everything up front, a half loaded state is worse than none
+        const header expected = makeHeader(console, stateSize(console));
+        if (h.magic != expected.magic || h.version != expected.version || h.size != expected.size ||
+            h.prgSize != expected.prgSize || h.chrSize != expected.chrSize || size < h.size)
+            return false;
+
+        // loading only ever reads from data
+        stream s = { const_cast<uint8_t*>(buffer), size, sizeof(h), true, true };
+        transfer(s, console);
+
+        if (console.mapper && console.mapper->chrWritable)
+            tiles::rebuild(console.bus.chrRam.data(), console.bus.chrRam.size(), console.ppu.decoded);
+
+        console.resync();
+        return s.ok;
+    }
+}
@@ -0,0 +1,129 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    system.cpp - keep the CPU, PPU and APU in step, lazily
+*/
+
+#include "../headers/emu/system.h"
+#include <algorithm>
+
+namespace emu
+{
+    Console::Console()
+        : mapper(nullptr), debugger(nullptr)
+    {
+        cpu.bus = &bus;
+        bus.console = this;
+        ppu.console = this;
+        apu.console = this;
+
+        initialize();
+    }
+
+    Console::~Console()
+    {
+        delete mapper;
+    }
+
+    void Console::runPpu(uint64_t to)
+    {
+        if (to > ppuCycle)
+        {
+            ppu.clock(static_cast<int>(to - ppuCycle));
+            ppuCycle = to;
+        }
+    }
+
+    void Console::initialize()
+    {
+        bus.initialize();
+        ppu.reset();
+        apu.reset();
+        cpu::initialize(cpu);
+
+        ppuCycle = 0;
+        deadline = 0;
+        irqLine = false;
+    }
+
+    uint64_t Console::accessCycle() const
+    {
+        // PC still points at the opcode while it executes, loads and stores hit the bus on its last cycle
+        // peek through the page table, going through a handler here could land right back in catchUp()
+        uint64_t at = cpu.cycles;
+        if (const uint8_t* page = bus.readPages[cpu.PC >> 8])
+        {
+            const cpu::CPU::instruction& instr = cpu::CPU::instructions[page[cpu.PC & 0xFF]];
+            at += instr.cycles ? instr.cycles - 1 : 0;
+        }
+        return at;
+    }
+
+    void Console::catchUp()
+    {
+        const uint64_t to = accessCycle();
+        runPpu(to);
+        apu.run(to);
+
+        // the access may move the next event (NMI enabled, rendering switched on...), re-check after this instruction
+        deadline = 0;
+    }
+
+    void Console::sync()
+    {
+        runPpu(cpu.cycles);
+        apu.run(cpu.cycles);
+    }
+
+    void Console::resync()
+    {
+        ppuCycle = cpu.cycles;
+        deadline = 0;
+        apu.resync();
+
+        // memory was replaced without going through the bus, the viewer has to look at all of it again
+        std::fill(bus.dirty, bus.dirty + 4, ~0ull);
+    }
+
+    uint16_t step(Console& console, uint8_t (*core)(cpu::CPU&))
+    {
+        cpu::CPU& c = console.cpu;
+
+        // an OAM DMA in this instruction adds its stall to the counter directly
+        const uint64_t start = c.cycles;
+        const uint8_t cycles = core(c);
+
+        if (!cycles)
+            return 0;
+
+        c.cycles += cycles;
+
+        // nothing due yet, which is almost always. a pending IRQ only matters once the I flag lets it through
+        if (c.cycles < console.deadline && !(console.irqLine && !c.getFlag(cpu::CPU::I)))
+            return static_cast<uint16_t>(c.cycles - start);
+
+        console.sync();
+
+        rom::Mapper* mapper = console.mapper;
+        const bool irq = (mapper && mapper->irq) || console.apu.irq();
+
+        if (console.ppu.nmi)
+        {
+            console.ppu.nmi = false;
+            cpu::NMI(c);
+            c.cycles += 7;
+        }
+        else if (irq && !c.getFlag(cpu::CPU::I))
+        {
+            cpu::IRQ(c);
+            c.cycles += 7;
+        }
+
+        // an IRQ held off by the I flag stays asserted, step() keeps an eye on the flag until it's taken
+        console.irqLine = (mapper && mapper->irq) || console.apu.irq();
+        console.deadline = std::min(console.ppuCycle + console.ppu.cyclesToEvent(mapper && mapper->scanlineIrq), console.apu.nextIrq());
+
+        return static_cast<uint16_t>(c.cycles - start);
+    }
+}
@@ -0,0 +1,102 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    trace.cpp - ring buffer of executed instructions for the debugger
+*/
+
+#include "../headers/emu/trace.h"
+#include "../headers/mem/ram.h"
+#include <cstdio>
+
+namespace emu
+{
+    trace::trace(size_t capacity)
+    {
+        // round up to a power of two
+        size_t cap = 1;
+        while (cap < capacity)
+            cap <<= 1;
+
+        entries.resize(cap);
+        mask = cap - 1;
+        count = 0;
+    }
+
+    void trace::push(const cpu::CPU& c)
+    {
+        entry& e = entries[count & mask];
+
+        e.cycle = c.cycles;
+        e.PC = c.PC;
+        // peeked, the operands may be I/O and a trace must not trip watchpoints
+        e.opcode[0] = c.bus->peek(c.PC);
+        e.opcode[1] = c.bus->peek(c.PC + 1);
+        e.opcode[2] = c.bus->peek(c.PC + 2);
+        e.A = c.A;
+        e.X = c.X;
+        e.Y = c.Y;
+        e.PS = c.PS;
+        e.SP = c.SP;
+
+        count++;
+    }
+
+    void trace::clear()
+    {
+        count = 0;
+    }
+
+    void trace::assign(const trace& other, size_t limit)
+    {
+        size_t n = other.size() < entries.size() ? other.size() : entries.size();
+        if (limit < n)
+            n = limit;
+
+        count = 0;
+        for (size_t i = other.size() - n; i < other.size(); i++)
+            entries[count++ & mask] = other.at(i);
+    }
+
+    size_t trace::size() const
+    {
+        return count < entries.size() ? static_cast<size_t>(count) : entries.size();
+    }
+
+    const trace::entry& trace::at(size_t i) const
+    {
+        // once wrapped, the oldest entry sits right after the head
+        uint64_t first = count - size();
+        return entries[(first + i) & mask];
+    }
+
+    int trace::format(size_t i, char* buf, size_t len) const
+    {
+        const entry& e = at(i);
+        const cpu::CPU::instruction& instr = cpu::CPU::instructions[e.opcode[0]];
+        const int size = instr.impl ? instr.size : 1;
+
+        // only the instruction's own bytes, the rest of opcode[] belongs to whatever comes next
+        char bytes[9] = {};
+        for (int b = 0, at = 0; b < size; b++)
+            at += snprintf(bytes + at, sizeof(bytes) - at, b ? " %02X" : "%02X", e.opcode[b]);
+
+        char operand[6] = {};
+        if (size == 2)
+            snprintf(operand, sizeof(operand), "$%02X", e.opcode[1]);
+        else if (size == 3)
+            snprintf(operand, sizeof(operand), "$%04X", e.opcode[1] | (e.opcode[2] << 8));
+
+        return snprintf(buf, len, "%04X  %-8s  %-4s %-5s  A: %02X X: %02X Y: %02X P: %02X SP: %02X  CYC: %llu",
+            e.PC,
+            bytes,
+            instr.name ? instr.name : "???",
+            operand,
+            e.A,
+            e.X,
+            e.Y,
+            e.PS,
+            e.SP,
+            (unsigned long long)e.cycle);
+    }
+}
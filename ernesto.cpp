@@ -4,11 +4,27 @@
 */
 
 #include <iostream>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <memory>
 #include "headers/mem/ram.h"
 #include "headers/cpu/cpu.h"
 #include "headers/rom/rom.h"
+#include "headers/rom/catalog.h"
 #include "headers/gfx/ppu.h"
+#include "headers/emu/headless.h"
+#include "headers/emu/batch.h"
+#include "headers/emu/trace.h"
+#include "headers/emu/system.h"
+#include "headers/emu/rewind.h"
+#include "headers/emu/triple.h"
+#include "headers/emu/debugger.h"
+#include "headers/snd/ring.h"
 
+// ERNESTO_NO_UI builds the same command line without SDL/ImGui, headless and batch runs only
+#ifndef ERNESTO_NO_UI
 #include "imgui.h"
 #include "imgui_impl_sdl2.h"
 #include "imgui_impl_sdlrenderer2.h"
@@ -25,14 +41,104 @@ SDL_Window* window = nullptr;
 SDL_Renderer* renderer = nullptr;
 SDL_Texture* texture = nullptr;
 
+// samples from the APU to the audio callback, about 170ms at 48khz
+apu::ring<int16_t> audio(8192);
+SDL_AudioDeviceID audioDevice = 0;
+int audioRate = 0;
+
+// frames are run on NTSC's 60.0988hz off the performance counter, whatever the display refreshes at. with
+// audio, the ring's fill level steers the APU's output rate by up to AUDIO_MAX_SKEW either way, so the fill
+// settles at AUDIO_TARGET seconds of sound however far the sound card's clock is from ours. the pitch change
+// is inaudible. past AUDIO_CEILING times the target (a stall, a clock way off) the excess is slept off
+const double AUDIO_TARGET = 0.04;
+const double AUDIO_MAX_SKEW = 0.005;
+const double AUDIO_CEILING = 2.0;
+
+// runs on SDL's audio thread, takes whatever the emulation has pushed and holds the last sample on underrun
+void audioCallback(void*, Uint8* stream, int len)
+{
+    static int16_t last = 0;
+
+    int16_t* out = reinterpret_cast<int16_t*>(stream);
+    const size_t count = len / sizeof(int16_t);
+    const size_t got = audio.pop(out, count);
+
+    if (got)
+        last = out[got - 1];
+    for (size_t i = got; i < count; i++)
+        out[i] = last;
+}
+
+// no audio device isn't fatal, the emulator just runs silent
+void initAudio()
+{
+    SDL_AudioSpec want = {};
+    SDL_AudioSpec have = {};
+    want.freq = 48000;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = 512;
+    want.callback = audioCallback;
+
+    audioDevice = SDL_OpenAudioDevice(nullptr, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (!audioDevice)
+    {
+        std::cerr << "SDL failed to open audio: " << SDL_GetError() << "\n";
+        return;
+    }
+
+    audioRate = have.freq;
+    SDL_PauseAudioDevice(audioDevice, 0);
+}
+
+// emulation thread, sleeps until it should run its next frame, never spins. returns the rate ratio to hand the APU
+double paceFrame(bool producing)
+{
+    static Uint64 next = 0;
+    static double ratio = 1.0;
+
+    const Uint64 frequency = SDL_GetPerformanceFrequency();
+    const Uint64 period = static_cast<Uint64>(frequency * emu::CYCLES_PER_FRAME / apu::CPU_RATE);
+
+    if (producing && audioRate)
+    {
+        const double target = audioRate * AUDIO_TARGET;
+
+        // signed, -1 with the ring empty, 0 on target, 1 at twice the target. more samples per frame while
+        // it's low, fewer while it's high, smoothed so one late frame doesn't wobble the pitch
+        const double error = std::clamp((audio.size() - target) / target, -1.0, 1.0);
+        ratio += (1.0 - AUDIO_MAX_SKEW * error - ratio) * 0.1;
+
+        // the hard ceiling, only after a stall or with a clock the skew can't keep up with
+        // the callback drains at exactly audioRate, so the excess tells how long to sleep
+        const size_t ceiling = static_cast<size_t>(target * AUDIO_CEILING);
+        size_t fill;
+        while ((fill = audio.size()) > ceiling)
+            SDL_Delay(std::max<Uint32>(1, static_cast<Uint32>((fill - ceiling) * 1000 / audioRate)));
+    }
+
+    // one frame per period, scheduled off the previous deadline so sleeping late doesn't add up.
+    // far behind (a breakpoint, a stall) the schedule restarts instead of running frames back to back
+    const Uint64 now = SDL_GetPerformanceCounter();
+    if (!next || now > next + period * 4)
+        next = now;
+    else if (now < next)
+        SDL_Delay(static_cast<Uint32>((next - now) * 1000 / frequency));
+    next += period;
+
+    return ratio;
+}
+
 bool initSDL()
 {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0)
     {
         std::cerr << "SDL failed to init: " << SDL_GetError() << "\n";
         return false;
     }
 
+    initAudio();
+
     window = SDL_CreateWindow("[ernesto] - ppu",
         SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
         SCREEN_WIDTH * 3, SCREEN_HEIGHT * 3, SDL_WINDOW_RESIZABLE);
@@ -43,7 +149,8 @@ bool initSDL()
         return false;
     }
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    // vsync only paces the UI thread, emulation keeps its own time (paceFrame)
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
 
     IMGUI_CHECKVERSION();
@@ -58,34 +165,703 @@ bool initSDL()
     return renderer && texture;
 }
 
-int main()
+// execute one instruction, logging it first when tracing is enabled
+uint16_t runInstruction(emu::Console& console, emu::trace& log, bool trace)
+{
+    if (trace)
+        log.push(console.cpu);
+
+    return emu::step(console);
+}
+
+// the emulation runs on a thread of its own and the UI never touches the Console. after every frame it
+// publishes a snapshot of everything the windows show into a triple buffer, and the UI posts what it wants
+// done through an SPSC queue. a slow window makes the UI drop snapshots, never the emulation drop frames
+
+// newest instructions carried in a snapshot while running, the whole log once paused
+const size_t TRACE_TAIL = 1024;
+
+// what the memory viewer can look at
+enum memorySpace
+{
+    CpuSpace,
+    VramSpace,
+    OamSpace,
+    PaletteSpace
+};
+
+// CPU pages a snapshot carries for the memory viewer, the rows on screen never span more
+const int VIEW_PAGES = 8;
+
+// how many snapshots a byte stays highlighted after it changed
+const uint32_t HIGHLIGHT_SNAPSHOTS = 30;
+
+struct snapshot
+{
+    uint32_t pixels[ppu::WIDTH * ppu::HEIGHT];
+
+    uint8_t A, X, Y, SP, PS;
+    uint16_t PC;
+
+    ppu::registers regs;
+    uint8_t oamData;
+    int scanline;
+    int dot;
+    uint64_t frame;
+
+    bool paused;
+    bool halted;
+    size_t rewindFrames;
+    size_t rewindBytes;
+
+    emu::trace log{ 1 << 16 };
+
+    // counts up by one per snapshot, a gap means the UI skipped some
+    uint64_t sequence;
+
+    // memory viewer: only the CPU pages the UI has on screen, peeked so I/O registers aren't disturbed,
+    // and the bus' dirty bitmap since the previous snapshot. the PPU side is small enough to always come along
+    uint8_t viewFirst;
+    int viewCount;
+    uint8_t view[VIEW_PAGES * 0x100];
+    uint64_t dirty[4];
+
+    uint8_t vram[0x1000];
+    uint8_t oam[0x100];
+    uint8_t palette[0x20];
+
+    // debugger, its breakpoints and why it last stopped
+    std::vector<emu::breakpoint> breakpoints;
+    emu::stopReason stop;
+    size_t stopIndex;
+    uint16_t stopAddress;
+    uint8_t stopValue;
+    emu::accessType stopAccess;
+};
+
+enum commandType
+{
+    Pause,
+    Step,
+    Trace,
+    Rewind,
+    ClearTrace,
+    Load, // value is an index into the library
+    View, // CPU pages the memory viewer shows, address is the first, value how many
+    Poke, // memory viewer edit, value into address of space
+    AddBreakpoint, // address to value, accessType bits in space, condition in text
+    RemoveBreakpoint, // value is the index
+    EnableBreakpoint, // value is the index, address 0 or 1
+    StepOver,
+    StepOut,
+    Quit
+};
+
+struct command
+{
+    commandType type;
+    int value;
+    uint16_t address;
+    int space;
+    char text[64];
+};
+
+emu::triple<snapshot>* frames = nullptr;
+apu::ring<command> commands(64);
+
+// UI side, a full queue drops the command (the emulation drains it every frame, it takes a stall to fill 64)
+void post(commandType type, int value = 0, uint16_t address = 0, int space = CpuSpace, const char* text = "")
+{
+    command cmd = { type, value, address, space, {} };
+    snprintf(cmd.text, sizeof(cmd.text), "%s", text);
+    commands.push(&cmd, 1);
+}
+
+void capture(snapshot& s, emu::Console& console, const emu::trace& log, const emu::rewind& history, bool paused, bool halted,
+    uint8_t viewFirst, int viewCount, const emu::Debugger& debugger)
+{
+    static uint64_t sequence = 0;
+
+    const cpu::CPU& c = console.cpu;
+
+    memcpy(s.pixels, console.ppu.framebuffer, sizeof(s.pixels));
+
+    s.A = c.A;
+    s.X = c.X;
+    s.Y = c.Y;
+    s.SP = c.SP;
+    s.PS = c.PS;
+    s.PC = c.PC;
+
+    s.regs = console.ppu.regs;
+    s.oamData = console.ppu.oam[console.ppu.regs.oamAddr];
+    s.scanline = console.ppu.scanline;
+    s.dot = console.ppu.dot;
+    s.frame = console.ppu.frame;
+
+    s.paused = paused;
+    s.halted = halted;
+    s.rewindFrames = history.size();
+    s.rewindBytes = history.used();
+
+    // while running only what fits on screen is worth copying
+    s.log.assign(log, paused || halted ? log.size() : TRACE_TAIL);
+
+    s.sequence = ++sequence;
+
+    s.viewFirst = viewFirst;
+    s.viewCount = viewCount;
+    for (int i = 0; i < viewCount * 0x100; i++)
+        s.view[i] = console.bus.peek(static_cast<uint16_t>((viewFirst << 8) + i));
+
+    // internal RAM is mirrored every 8 pages up to 0x1FFF, a write through one mirror changes all four
+    uint64_t* dirty = console.bus.dirty;
+    const uint64_t ram = (dirty[0] | dirty[0] >> 8 | dirty[0] >> 16 | dirty[0] >> 24) & 0xFF;
+    dirty[0] |= ram * 0x01010101ull;
+
+    memcpy(s.dirty, dirty, sizeof(s.dirty));
+    std::fill(dirty, dirty + 4, 0);
+
+    memcpy(s.vram, console.ppu.vram, sizeof(s.vram));
+    memcpy(s.oam, console.ppu.oam, sizeof(s.oam));
+    memcpy(s.palette, console.ppu.palette, sizeof(s.palette));
+
+    s.breakpoints = debugger.points;
+    s.stop = debugger.reason;
+    s.stopIndex = debugger.hitIndex;
+    s.stopAddress = debugger.hitAddress;
+    s.stopValue = debugger.hitValue;
+    s.stopAccess = debugger.hitAccess;
+}
+
+// the emulation thread, owns the Console until it sees Quit
+void emulate(emu::Console* console, const rom::catalog* library)
+{
+    cpu::CPU* c = &console->cpu;
+
+    bool paused = false;
+    bool step = false;
+    bool halted = false;
+    bool trace = true;
+    bool rewinding = false;
+
+    // what the memory viewer has on screen
+    uint8_t viewFirst = 0;
+    int viewCount = 0;
+
+    emu::trace log;
+    emu::rewind history;
+
+    // stays attached across ROM loads, power on keeps the bus' watched pages
+    emu::Debugger debugger;
+    debugger.attach(*console);
+
+    // instructions don't end exactly on a frame boundary, carry the overshoot into the next frame
+    int32_t frameCycles = 0;
+
+    for (;;)
+    {
+        // everything the UI asked for since the last frame
+        bool changed = false;
+        command cmd;
+        while (commands.pop(&cmd, 1))
+        {
+            changed = true;
+            switch (cmd.type)
+            {
+            case Pause:
+                // carrying on from a breakpoint runs the instruction it stopped in front of
+                if (paused && !cmd.value)
+                    debugger.resume();
+                paused = cmd.value;
+                break;
+            case Step:
+                step = paused;
+                debugger.resume();
+                break;
+            case Trace:
+                trace = cmd.value;
+                break;
+            case Rewind:
+                rewinding = cmd.value;
+                break;
+            case ClearTrace:
+                log.clear();
+                break;
+            case Load:
+                // power cycle into the new cartridge, from its reset vector
+                console->initialize();
+                if (rom::testLoad(*console, library->entries[cmd.value].path.c_str()))
+                {
+                    c->PS = 0x24;
+                    c->PC = console->bus.read(0xFFFC) | (console->bus.read(0xFFFD) << 8);
+                    halted = false;
+                }
+                else
+                    halted = true;
+
+                log.clear();
+                history.clear();
+                frameCycles = 0;
+                break;
+            case View:
+                viewFirst = static_cast<uint8_t>(cmd.address >> 8);
+                viewCount = std::min(cmd.value, std::min(VIEW_PAGES, 0x100 - viewFirst));
+                break;
+            case Poke:
+                // plain memory only, an edit must not land in a register and set something off
+                if (cmd.space == CpuSpace && console->bus.writePages[cmd.address >> 8])
+                    console->bus.write(cmd.address, static_cast<uint8_t>(cmd.value));
+                else if (cmd.space == VramSpace)
+                    console->ppu.vram[cmd.address & 0x0FFF] = static_cast<uint8_t>(cmd.value);
+                else if (cmd.space == OamSpace)
+                    console->ppu.oam[cmd.address & 0xFF] = static_cast<uint8_t>(cmd.value);
+                else if (cmd.space == PaletteSpace)
+                    console->ppu.palette[cmd.address & 0x1F] = static_cast<uint8_t>(cmd.value);
+                break;
+            case AddBreakpoint:
+            {
+                std::string error;
+                debugger.add(cmd.address, static_cast<uint16_t>(cmd.value), static_cast<uint8_t>(cmd.space), cmd.text, error);
+                break;
+            }
+            case RemoveBreakpoint:
+                debugger.remove(cmd.value);
+                break;
+            case EnableBreakpoint:
+                debugger.enable(cmd.value, cmd.address);
+                break;
+            case StepOver:
+            case StepOut:
+                if (!paused || halted)
+                    break;
+                if (cmd.type == StepOver)
+                    debugger.stepOver();
+                else
+                    debugger.stepOut();
+                debugger.resume();
+                paused = false;
+                break;
+            case Quit:
+                debugger.detach();
+                return;
+            }
+        }
+
+        // wait for the next frame on the clock, with audio the APU rate keeps the ring near its target
+        // rewinding never runs forward, with no history left it idles like paused
+        const bool producing = rewinding ? history.size() > 0 : !halted && !paused;
+        const double ratio = paceFrame(producing);
+        if (audioRate)
+            console->apu.setRatio(ratio);
+
+        // run a whole NTSC frame worth of cycles
+        bool newFrame = false;
+        if (rewinding)
+        {
+            // the state doesn't hold a picture, replay one frame from the restored state to get one
+            if (history.step(*console))
+            {
+                halted = false;
+                frameCycles = emu::CYCLES_PER_FRAME;
+            }
+        }
+        else if (!halted && !paused)
+        {
+            frameCycles += emu::CYCLES_PER_FRAME;
+            newFrame = true;
+        }
+
+        while (!halted && (frameCycles > 0 || step))
+        {
+            // breakpoints, watchpoints and stepping, a single branch while none are set
+            if (debugger.armed && debugger.beforeInstruction())
+            {
+                paused = true;
+                changed = true;
+                frameCycles = 0;
+                break;
+            }
+
+            uint16_t cycles = runInstruction(*console, log, trace);
+
+            if (!cycles)
+            {
+                printf("\n[ernesto] - unimplemented opcode: %02X", console->bus.peek(c->PC));
+                halted = true;
+                changed = true;
+            }
+
+            // single steps while paused don't eat into the frame budget
+            if (frameCycles > 0)
+                frameCycles -= cycles;
+
+            step = false;
+        }
+
+        // the PPU runs lazily, let it finish up to where the CPU stopped
+        console->sync();
+
+        // one snapshot per emulated frame, not while replaying during rewind
+        if (newFrame && !halted)
+            history.push(*console);
+
+        // idle with nothing new, the UI already has the last one
+        if (!producing && !changed)
+            continue;
+
+        capture(frames->back(), *console, log, history, paused, halted, viewFirst, viewCount, debugger);
+        frames->publish();
+    }
+}
+
+// the UI's copy of one memory space, filled in from snapshots. every byte remembers the snapshot it last
+// changed in, which is what the editor highlights
+struct memoryView
+{
+    memorySpace space;
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> changed;
+
+    // addresses the editor read while drawing, the rows on screen
+    size_t first;
+    size_t last;
+};
+
+uint32_t snapshotsSeen = 0;
+
+// copy bytes in, stamping the ones that differ. quiet skips the stamps (first look at a page)
+void merge(memoryView& v, const uint8_t* src, size_t offset, size_t size, bool quiet)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (v.data[offset + i] == src[i])
+            continue;
+
+        v.data[offset + i] = src[i];
+        if (!quiet)
+            v.changed[offset + i] = snapshotsSeen;
+    }
+}
+
+void mergeSnapshot(memoryView* views, const snapshot& f)
+{
+    static uint64_t lastSequence = 0;
+    static uint8_t lastFirst = 0;
+    static int lastCount = 0;
+
+    snapshotsSeen++;
+
+    // pages that stayed on screen only need a look when the bitmap says they were written. a skipped
+    // snapshot took its bits with it, then everything on screen gets compared
+    const bool gap = f.sequence != lastSequence + 1;
+    for (int i = 0; i < f.viewCount; i++)
+    {
+        const int page = f.viewFirst + i;
+        const bool seen = page >= lastFirst && page < lastFirst + lastCount;
+        const bool written = (f.dirty[page >> 6] >> (page & 63)) & 1;
+
+        if (!seen || written || gap)
+            merge(views[CpuSpace], &f.view[i << 8], static_cast<size_t>(page) << 8, 0x100, !seen);
+    }
+
+    lastSequence = f.sequence;
+    lastFirst = f.viewFirst;
+    lastCount = f.viewCount;
+
+    // nothing tracks PPU side writes, these are a few kb, compare them whole
+    merge(views[VramSpace], f.vram, 0, sizeof(f.vram), false);
+    merge(views[OamSpace], f.oam, 0, sizeof(f.oam), false);
+    merge(views[PaletteSpace], f.palette, 0, sizeof(f.palette), false);
+}
+
+// editor callbacks, user data is the memoryView being drawn
+ImU8 viewRead(const ImU8* data, size_t offset, void* user)
+{
+    memoryView* v = static_cast<memoryView*>(user);
+    v->first = std::min(v->first, offset);
+    v->last = std::max(v->last, offset);
+    return data[offset];
+}
+
+void viewWrite(ImU8*, size_t offset, ImU8 value, void* user)
+{
+    post(Poke, value, static_cast<uint16_t>(offset), static_cast<memoryView*>(user)->space);
+}
+
+bool viewHighlight(const ImU8*, size_t offset, void* user)
+{
+    const uint32_t at = static_cast<memoryView*>(user)->changed[offset];
+    return at && snapshotsSeen - at < HIGHLIGHT_SNAPSHOTS;
+}
+#endif
+
+void usage()
+{
+    std::cout << "usage: ernesto [--rom path] [--pc hex | --reset] [--headless [--instructions n] [--cycles n] [--frames n] [--core table|switch]]\n";
+    std::cout << "       ernesto --batch dir|manifest [--threads n] [--instructions n] [--cycles n] [--frames n] [--core table|switch]\n";
+    std::cout << "       ernesto --library dir [--index file] [--threads n] (headless: list it, otherwise a library window)\n";
+}
+
+// where the catalog index goes when --index isn't given
+std::string defaultIndex(const char* library)
+{
+    return std::string(library) + "/.ernesto-catalog";
+}
+
+// scan a ROM library and print it, one line per ROM
+int listLibrary(const char* library, const char* index, unsigned threads)
+{
+    const std::string indexPath = index ? index : defaultIndex(library);
+
+    auto start = std::chrono::steady_clock::now();
+    rom::catalog c = rom::scanCatalog(library, indexPath.c_str(), threads);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (const rom::catalogEntry& e : c.entries)
+    {
+        if (!e.valid)
+        {
+            printf("%-8s %-39s %s\n", "invalid", "", e.path.c_str());
+            continue;
+        }
+
+        printf("%08X %016llX mapper %3d.%d %4zuk/%3zuk  %s\n",
+            e.crc,
+            (unsigned long long)e.hash,
+            e.info.mapper,
+            e.info.submapper,
+            e.info.prgRom / 1024,
+            e.info.chrRom / 1024,
+            e.path.c_str());
+    }
+
+    printf("[ernesto] - %zu ROMs, %zu hashed, %zu from the index in %.3fs\n",
+        c.entries.size(),
+        c.hashed,
+        c.entries.size() - c.hashed,
+        seconds);
+
+    return 0;
+}
+
+// run every ROM in a directory or manifest headless, one line per ROM and a summary
+// exits with 1 if anything failed to load, hit an unimplemented opcode or reported a failing test
+int runBatch(const char* path, emu::limits limits, unsigned threads, uint8_t (*core)(cpu::CPU&))
+{
+    std::vector<std::string> roms = emu::batchList(path);
+    if (roms.empty())
+    {
+        std::cerr << "[ernesto] - no ROMs found in " << path << "\n";
+        return -1;
+    }
+
+    // test ROMs stop on their own, the budget is for everything else
+    if (!limits.instructions && !limits.cycles && !limits.frames)
+        limits.frames = 600;
+    limits.testStatus = true;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<emu::batchResult> results = emu::runBatch(roms, limits, threads, core);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    uint64_t cycles = 0;
+
+    for (const emu::batchResult& b : results)
+    {
+        const emu::result& r = b.run;
+        char outcome[32];
+
+        if (!b.loaded)
+            snprintf(outcome, sizeof(outcome), "load failed");
+        else if (!b.supported)
+            snprintf(outcome, sizeof(outcome), "unsupported mapper");
+        else if (r.halt == emu::Unimplemented)
+            snprintf(outcome, sizeof(outcome), "halted at %04X", r.pc);
+        else if (r.halt == emu::Finished)
+            snprintf(outcome, sizeof(outcome), r.status ? "failed (%02X)" : "passed", r.status);
+        else
+            snprintf(outcome, sizeof(outcome), "ran");
+
+        if (!b.supported || r.halt == emu::Unimplemented || (r.halt == emu::Finished && r.status))
+            failed++;
+        cycles += r.cycles;
+
+        printf("%-16s %6llu frames %12llu cycles %8.3fs  %s\n",
+            outcome,
+            (unsigned long long)r.frames,
+            (unsigned long long)r.cycles,
+            r.seconds,
+            b.path.c_str());
+    }
+
+    printf("[ernesto] - %zu ROMs, %d failed, %llu cycles in %.3fs\n",
+        results.size(),
+        failed,
+        (unsigned long long)cycles,
+        seconds);
+
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv)
 {
     std::cout << "[ernesto] - welcome\n";
-    
-    // initialize memory
-    memory::initialize();
 
-    // load a ROM into memory
-    rom::testLoad();
+    const char* romPath = nullptr;
+    const char* batchPath = nullptr;
+    const char* libraryPath = nullptr;
+    const char* indexPath = nullptr;
+    unsigned threads = 0;
+    bool headless = false;
+    long pcOverride = -1;
+    bool reset = false;
+    emu::limits limits = {};
+    uint8_t (*core)(cpu::CPU&) = cpu::step;
 
-    // initialize CPU
-    cpu::CPU* c = cpu::initialize();
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
 
-    uint8_t rvL = memory::read(0xFFFC);
-    uint8_t rvH = memory::read(0xFFFD);
+        if (arg == "--headless")
+            headless = true;
+        else if (arg == "--rom" && hasValue)
+            romPath = argv[++i];
+        else if (arg == "--pc" && hasValue)
+            pcOverride = strtol(argv[++i], nullptr, 16);
+        else if (arg == "--reset")
+            reset = true;
+        else if (arg == "--instructions" && hasValue)
+            limits.instructions = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--cycles" && hasValue)
+            limits.cycles = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--frames" && hasValue)
+            limits.frames = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--batch" && hasValue)
+            batchPath = argv[++i];
+        else if (arg == "--library" && hasValue)
+            libraryPath = argv[++i];
+        else if (arg == "--index" && hasValue)
+            indexPath = argv[++i];
+        else if (arg == "--threads" && hasValue)
+            threads = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--core" && hasValue)
+            core = std::string(argv[++i]) == "table" ? cpu::stepTable : cpu::stepSwitch;
+        else
+        {
+            usage();
+            return -1;
+        }
+    }
+
+#ifdef ERNESTO_NO_UI
+    // nothing to draw on
+    headless = true;
+#endif
+
+    if (batchPath)
+        return runBatch(batchPath, limits, threads, core);
+
+    if (libraryPath && headless)
+        return listLibrary(libraryPath, indexPath, threads);
+
+    // power on memory, PPU and CPU, on the heap since a Console is too big for the stack
+    std::unique_ptr<emu::Console> console(new emu::Console());
+    cpu::CPU* c = &console->cpu;
+
+    // load a ROM into memory
+    bool loaded = romPath ? rom::testLoad(*console, romPath) : rom::testLoad(*console);
+    if (!loaded)
+    {
+        std::cerr << "[ernesto] - couldn't load " << (romPath ? romPath : "the default ROM") << "\n";
+        return -1;
+    }
+
+    uint8_t rvL = console->bus.read(0xFFFC);
+    uint8_t rvH = console->bus.read(0xFFFD);
 
     uint16_t rv = (rvH << 8) | rvL;
 
-    // c->PC = rv;
+    // nestest's automated mode starts at 0xC000, real games boot from the reset vector
     c->PS = 0x24;
-    c->PC = 0xC000;
+    c->PC = pcOverride >= 0 ? static_cast<uint16_t>(pcOverride) : 0xC000;
+    if (reset)
+        c->PC = rv;
+
+    if (headless)
+    {
+        // no limits given, just run a second worth of frames
+        if (!limits.instructions && !limits.cycles && !limits.frames)
+            limits.frames = 60;
+
+        emu::result r = emu::runHeadless(*console, limits, core);
+
+        if (r.halt == emu::Unimplemented)
+            printf("[ernesto] - unimplemented opcode: %02X at %04X\n", console->bus.read(r.pc), r.pc);
+
+        printf("[ernesto] - %llu instructions, %llu cycles, %llu frames in %.3fs (%.2f MIPS, %.2f MHz)\n",
+            (unsigned long long)r.instructions,
+            (unsigned long long)r.cycles,
+            (unsigned long long)r.frames,
+            r.seconds,
+            r.seconds > 0 ? r.instructions / r.seconds / 1e6 : 0.0,
+            r.seconds > 0 ? r.cycles / r.seconds / 1e6 : 0.0);
 
+        return r.halt == emu::Completed ? 0 : 1;
+    }
+
+#ifndef ERNESTO_NO_UI
     if (!initSDL()) return -1;
 
+    if (audioRate)
+    {
+        console->apu.output = &audio;
+        console->apu.setRate(audioRate);
+    }
+
+    // ROM library, scanned once at startup, only files that changed since the last run get opened
+    rom::catalog library = {};
+    if (libraryPath)
+        library = rom::scanCatalog(libraryPath, (indexPath ? std::string(indexPath) : defaultIndex(libraryPath)).c_str(), threads);
+
+    // from here on the Console belongs to the emulation thread
+    frames = new emu::triple<snapshot>();
+    std::thread emulation(emulate, console.get(), &library);
+
     bool running = true;
+    bool paused = false;
+    bool trace = true;
+    bool follow = true;
+    bool rewinding = false;
     SDL_Event e;
 
-    std::vector<std::string> log;
+    // memory viewer, indexed by memorySpace
+    memoryView views[] =
+    {
+        { CpuSpace, std::vector<uint8_t>(0x10000), std::vector<uint32_t>(0x10000), 0, 0 },
+        { VramSpace, std::vector<uint8_t>(0x1000), std::vector<uint32_t>(0x1000), 0, 0 },
+        { OamSpace, std::vector<uint8_t>(0x100), std::vector<uint32_t>(0x100), 0, 0 },
+        { PaletteSpace, std::vector<uint8_t>(0x20), std::vector<uint32_t>(0x20), 0, 0 }
+    };
+    const char* const spaceNames[] = { "cpu", "vram", "oam", "palette" };
+    int space = CpuSpace;
+    int viewPosted = -1;
+
+    // debugger window, the breakpoint being typed in
+    bool emulationPaused = false;
+    char breakRange[16] = "";
+    char breakCondition[64] = "";
+    bool breakExec = true;
+    bool breakRead = false;
+    bool breakWrite = false;
+    std::string breakError;
+
+    MemoryEditor editor;
+    editor.ReadFn = viewRead;
+    editor.WriteFn = viewWrite;
+    editor.HighlightFn = viewHighlight;
 
     while (running)
     {
@@ -95,23 +871,26 @@ int main()
             running = !(e.type == SDL_QUIT);
         }
 
-        uint8_t opcode[3];
-        opcode[0] = memory::read(c->PC);
-        opcode[1] = memory::read(c->PC + 1);
-        opcode[2] = memory::read(c->PC + 2);
-        const cpu::CPU::instruction& instr = c->instructions[opcode[0]];
-
-        /* printf("%04X  %02X %02X %02X  %s  A:%02X X:%02X Y:%02X P:%02X SP:%02X\n",
-            c->PC,
-            opcode[0],
-            opcode[1],
-            opcode[2],
-            instr.name.c_str(),
-            c->A,
-            c->X,
-            c->Y,
-            c->PS,
-            c->SP); */
+        // upload the picture only when the emulation has finished a new one
+        if (frames->update())
+        {
+            void* pixels;
+            int pitch;
+            if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) == 0)
+            {
+                for (int y = 0; y < ppu::HEIGHT; y++)
+                    memcpy(static_cast<uint8_t*>(pixels) + y * pitch, &frames->front().pixels[y * ppu::WIDTH], ppu::WIDTH * sizeof(uint32_t));
+                SDL_UnlockTexture(texture);
+            }
+
+            mergeSnapshot(views, frames->front());
+
+            // the emulation pauses itself on a breakpoint, follow it when its state flips
+            if (frames->front().paused != emulationPaused)
+                paused = emulationPaused = frames->front().paused;
+        }
+
+        const snapshot& f = frames->front();
 
         ImGui_ImplSDLRenderer2_NewFrame();
         ImGui_ImplSDL2_NewFrame();
@@ -120,112 +899,261 @@ int main()
 
         ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_FirstUseEver);
 
-        char buf[256];
-        snprintf(buf, sizeof(buf), "%04X  %02X %02X %02X  %s %02X %02X  A: %02X X: %02X Y: %02X P: %02X SP: %02X\n",
-            c->PC,
-            opcode[0],
-            opcode[1],
-            opcode[2],
-            instr.name.c_str(),
-            opcode[1],
-            opcode[2],
-            c->A,
-            c->X,
-            c->Y,
-            c->PS,
-            c->SP);
-
-        log.push_back(buf);
-
         ImGui::Begin("[ernesto] - instructions", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
-        
-        for (const auto& line : log)
-            ImGui::TextUnformatted(line.c_str());
+        ImGui::Checkbox("follow", &follow);
+        ImGui::SameLine();
+        if (ImGui::Button("clear"))
+            post(ClearTrace);
 
-        // ImGui::SetScrollHereY(1.0f);
+        ImGui::BeginChild("trace", ImVec2(620, 400), true, ImGuiWindowFlags_HorizontalScrollbar);
 
+        // only format the rows that are actually on screen
+        ImGuiListClipper clipper;
+        clipper.Begin(static_cast<int>(f.log.size()));
+        while (clipper.Step())
+        {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+            {
+                char line[128];
+                f.log.format(i, line, sizeof(line));
+                ImGui::TextUnformatted(line);
+            }
+        }
+        clipper.End();
+
+        if (follow && !paused)
+            ImGui::SetScrollHereY(1.0f);
+
+        ImGui::EndChild();
         ImGui::End();
 
         ImGui::Begin("[ernesto] - cpu", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
-        ImGui::Text("A: %02X", c->A);
-        ImGui::Text("X: %02X", c->X);
-        ImGui::Text("Y: %02X", c->Y);
-        ImGui::Text("SP: %02X", c->SP);
-        ImGui::Text("PC: %02X", c->PC);
+        ImGui::Text("A: %02X", f.A);
+        ImGui::Text("X: %02X", f.X);
+        ImGui::Text("Y: %02X", f.Y);
+        ImGui::Text("SP: %02X", f.SP);
+        ImGui::Text("PC: %02X", f.PC);
         ImGui::Text("PS: ");
         for (int i = 7; i >= 0; --i)
         {
-            bool bit = (c->PS >> i) & 1;
+            bool bit = (f.PS >> i) & 1;
             ImGui::SameLine();
             ImGui::Text("%d", bit);
         }
+        if (ImGui::Checkbox("pause", &paused))
+            post(Pause, paused);
+        ImGui::SameLine();
+        if (ImGui::Button("step") && paused)
+            post(Step);
+        ImGui::SameLine();
+        if (ImGui::Checkbox("trace", &trace))
+            post(Trace, trace);
+
+        // hold to go back, one frame per emulated frame
+        ImGui::Button("rewind");
+        if (ImGui::IsItemActive() != rewinding)
+        {
+            rewinding = !rewinding;
+            post(Rewind, rewinding);
+        }
+        ImGui::SameLine();
+        ImGui::Text("%zu frames, %zu kb", f.rewindFrames, f.rewindBytes / 1024);
+
+        if (f.halted)
+            ImGui::Text("halted at %04X", f.PC);
         ImGui::End();
 
         ImGui::Begin("[ernesto] - ppu", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
         ImGui::Text("PPU_CTRL: ");
         for (int i = 7; i >= 0; --i)
         {
-            bool bit = (0 >> i) & 1;
+            bool bit = (f.regs.ctrl >> i) & 1;
             ImGui::SameLine();
             ImGui::Text("%d", bit);
         }
         ImGui::Text("PPU_MASK: ");
         for (int i = 7; i >= 0; --i)
         {
-            bool bit = (0 >> i) & 1;
+            bool bit = (f.regs.mask >> i) & 1;
             ImGui::SameLine();
             ImGui::Text("%d", bit);
         }
         ImGui::Text("PPU_STATUS: ");
         for (int i = 7; i >= 0; --i)
         {
-            bool bit = (0 >> i) & 1;
+            bool bit = (f.regs.status >> i) & 1;
             ImGui::SameLine();
             ImGui::Text("%d", bit);
         }
-        ImGui::Text("OAM_ADDR: %02X", 0);
-        ImGui::Text("OAM_DATA: %02X", 0);
-        ImGui::Text("PPU_SCROLL: %04X", 0);
-        ImGui::Text("PPU_ADDR: %04X", 0);
-        ImGui::Text("PPU_DATA: %02X", 0);
-        ImGui::Text("OAM_DMA: %02X", 0);
+        ImGui::Text("OAM_ADDR: %02X", f.regs.oamAddr);
+        ImGui::Text("OAM_DATA: %02X", f.oamData);
+        ImGui::Text("PPU_SCROLL: %04X", f.regs.t);
+        ImGui::Text("PPU_ADDR: %04X", f.regs.v);
+        ImGui::Text("PPU_DATA: %02X", f.regs.readBuffer);
+        ImGui::Text("SCANLINE: %d DOT: %d FRAME: %llu", f.scanline, f.dot, (unsigned long long)f.frame);
         ImGui::End();
 
         ImGui::Begin("[ernesto] - display", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
         ImGui::Image((ImTextureID)texture, ImVec2(256, 240));
         ImGui::End();
 
-        ImGui::Render();
+        // the editor only reads the rows it draws, whatever it read is what the next snapshot carries
+        memoryView& view = views[space];
+        view.first = SIZE_MAX;
+        view.last = 0;
 
-        SDL_RenderClear(renderer);
+        ImGui::Begin("[ernesto] - memory");
+        ImGui::Combo("space", &space, spaceNames, 4);
+        editor.UserData = &view;
+        editor.DrawContents(view.data.data(), view.data.size());
+        ImGui::End();
 
-        // SDL_RenderCopy(renderer, texture, NULL, NULL);
-        ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData(), renderer);
-        SDL_RenderPresent(renderer);
+        ImGui::Begin("[ernesto] - debugger", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+        ImGui::InputText("address", breakRange, sizeof(breakRange));
+        ImGui::SameLine();
+        ImGui::TextDisabled("C000 or C000-C0FF");
+        ImGui::Checkbox("exec", &breakExec);
+        ImGui::SameLine();
+        ImGui::Checkbox("read", &breakRead);
+        ImGui::SameLine();
+        ImGui::Checkbox("write", &breakWrite);
+        ImGui::InputText("condition", breakCondition, sizeof(breakCondition));
+        ImGui::SameLine();
+        ImGui::TextDisabled("ex: a == $10 && [$0300] != 0");
 
-        uint8_t oldPc;
+        if (ImGui::Button("add"))
+        {
+            // checked here too so a typo shows up right away, the emulation compiles it again
+            char* end;
+            const char* text = breakRange[0] == '$' ? breakRange + 1 : breakRange;
+            const unsigned long first = strtoul(text, &end, 16);
+            const unsigned long last = *end == '-' ? strtoul(end + 1, &end, 16) : first;
+            const int access = (breakExec ? emu::Exec : 0) | (breakRead ? emu::Read : 0) | (breakWrite ? emu::Write : 0);
 
-        if (c->PC == 0xC657)
-            printf("FUCJ");
+            emu::condition check;
+            if (end == text || *end || first > 0xFFFF || last > 0xFFFF)
+                breakError = "address has to be hex, one or a range";
+            else if (!access)
+                breakError = "pick exec, read or write";
+            else if (check.compile(breakCondition, breakError))
+                post(AddBreakpoint, static_cast<int>(last), static_cast<uint16_t>(first), access, breakCondition);
+        }
+        if (!breakError.empty())
+        {
+            ImGui::SameLine();
+            ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", breakError.c_str());
+        }
 
-        if (instr.impl)
+        for (size_t i = 0; i < f.breakpoints.size(); i++)
         {
-            oldPc = c->PC;
+            const emu::breakpoint& b = f.breakpoints[i];
+            bool enabled = b.enabled;
 
-            int cycles = instr.cycles;
+            ImGui::PushID(static_cast<int>(i));
+            if (ImGui::Checkbox("##enabled", &enabled))
+                post(EnableBreakpoint, static_cast<int>(i), enabled);
+            ImGui::SameLine();
+            ImGui::Text("%04X-%04X %c%c%c %6llu hits  %s", b.first, b.last,
+                b.access & emu::Exec ? 'x' : '-', b.access & emu::Read ? 'r' : '-', b.access & emu::Write ? 'w' : '-',
+                (unsigned long long)b.hits, b.text.c_str());
+            ImGui::SameLine();
+            if (ImGui::SmallButton("remove"))
+                post(RemoveBreakpoint, static_cast<int>(i));
+            ImGui::PopID();
+        }
 
-            instr.impl(*c, instr.mode);
+        ImGui::Separator();
+        if (ImGui::Button("continue") && paused)
+        {
+            paused = false;
+            post(Pause, 0);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("step over"))
+            post(StepOver);
+        ImGui::SameLine();
+        if (ImGui::Button("step out"))
+            post(StepOut);
 
-            if (!instr.incrementPc)
-                c->PC += instr.size;
+        if (f.paused && f.stop == emu::Breakpoint)
+        {
+            static const char* const accessNames[] = { "", "exec", "read", "", "write" };
+            ImGui::Text("stopped at %04X, breakpoint %zu (%s %04X = %02X)", f.PC, f.stopIndex, accessNames[f.stopAccess],
+                f.stopAddress, f.stopValue);
         }
-        else
+        else if (f.paused && f.stop == emu::StepDone)
+            ImGui::Text("stepped to %04X", f.PC);
+        ImGui::End();
+
+        if (view.space == CpuSpace && view.first <= view.last)
         {
-            printf("\n[ernesto] - unimplemented opcode: %02X", opcode[0]);
-            continue;
+            const int first = static_cast<int>(view.first >> 8);
+            const int count = static_cast<int>(view.last >> 8) - first + 1;
+            if ((first | count << 8) != viewPosted)
+            {
+                post(View, count, static_cast<uint16_t>(first << 8));
+                viewPosted = first | count << 8;
+            }
         }
+
+        if (libraryPath)
+        {
+            ImGui::Begin("[ernesto] - library", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+            ImGui::Text("%zu ROMs, %zu hashed this run", library.entries.size(), library.hashed);
+            ImGui::BeginChild("roms", ImVec2(620, 300), true, ImGuiWindowFlags_HorizontalScrollbar);
+
+            ImGuiListClipper romClipper;
+            romClipper.Begin(static_cast<int>(library.entries.size()));
+            while (romClipper.Step())
+            {
+                for (int i = romClipper.DisplayStart; i < romClipper.DisplayEnd; i++)
+                {
+                    const rom::catalogEntry& entry = library.entries[i];
+                    if (!entry.valid)
+                    {
+                        ImGui::TextDisabled("invalid   %s", entry.path.c_str());
+                        continue;
+                    }
+
+                    // the emulation thread power cycles into it
+                    ImGui::PushID(i);
+                    if (ImGui::SmallButton("load"))
+                        post(Load, i);
+                    ImGui::PopID();
+                    ImGui::SameLine();
+                    ImGui::Text("%08X  mapper %3d  %4zuk/%3zuk  %s", entry.crc, entry.info.mapper,
+                        entry.info.prgRom / 1024, entry.info.chrRom / 1024, entry.path.c_str());
+                }
+            }
+            romClipper.End();
+
+            ImGui::EndChild();
+            ImGui::End();
+        }
+
+        ImGui::Render();
+
+        SDL_RenderClear(renderer);
+
+        // SDL_RenderCopy(renderer, texture, NULL, NULL);
+        ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData(), renderer);
+        SDL_RenderPresent(renderer);
     }
 
+    // Quit can't be dropped, the emulation drains the queue every frame
+    const command quit = { Quit, 0 };
+    while (!commands.push(&quit, 1))
+        SDL_Delay(1);
+    emulation.join();
+
+    // stop the callback before anything it reads goes away
+    if (audioDevice)
+        SDL_CloseAudioDevice(audioDevice);
+
+    delete frames;
+    frames = nullptr;
+
     cin.get();
+#endif
     return 0;
 }
\ No newline at end of file
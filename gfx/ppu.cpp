@@ -1,13 +1,512 @@
 /*
     ernesto - 6502, ergo NES emulator
     author: Iago Maldonado (@iagoMAO)
+
+    ppu.cpp - 2C02, registers, VRAM and a scanline renderer
 */
 
-#include "../headers/gfx/ppu.h";
+#include "../headers/gfx/ppu.h"
+#include "../headers/emu/system.h"
+#include "../headers/rom/mapper.h"
+#include "../headers/gfx/tiles.h"
 #include <cstdint>
-#include <ctime>
+#include <cstring>
 
 namespace ppu
 {
-   
-}
\ No newline at end of file
+    const uint32_t systemPalette[64] =
+    {
+        0xFF666666, 0xFF002A88, 0xFF1412A7, 0xFF3B00A4, 0xFF5C007E, 0xFF6E0040, 0xFF6C0600, 0xFF561D00,
+        0xFF333500, 0xFF0B4800, 0xFF005200, 0xFF004F08, 0xFF00404D, 0xFF000000, 0xFF000000, 0xFF000000,
+        0xFFADADAD, 0xFF155FD9, 0xFF4240FF, 0xFF7527FE, 0xFFA01ACC, 0xFFB71E7B, 0xFFB53120, 0xFF994E00,
+        0xFF6B6D00, 0xFF388700, 0xFF0C9300, 0xFF008F32, 0xFF007C8D, 0xFF000000, 0xFF000000, 0xFF000000,
+        0xFFFFFEFF, 0xFF64B0FF, 0xFF9290FF, 0xFFC676FF, 0xFFF36AFF, 0xFFFE6ECC, 0xFFFE8170, 0xFFEA9E22,
+        0xFFBCBE00, 0xFF88D800, 0xFF5CE430, 0xFF45E082, 0xFF48CDDE, 0xFF4F4F4F, 0xFF000000, 0xFF000000,
+        0xFFFFFEFF, 0xFFC0DFFF, 0xFFD3D2FF, 0xFFE8C8FF, 0xFFFBC2FF, 0xFFFEC4EA, 0xFFFECCC5, 0xFFF7D8A5,
+        0xFFE4E594, 0xFFCFEF96, 0xFFBDF4AB, 0xFFB3F3CC, 0xFFB5EBF2, 0xFFB8B8B8, 0xFF000000, 0xFF000000
+    };
+
+    bool PPU::rendering()
+    {
+        // background or sprites enabled
+        return regs.mask & 0x18;
+    }
+
+    uint8_t* PPU::nametable(uint16_t addr)
+    {
+        // four logical 1kb nametables folded onto the physical ones by the cart's mirroring
+        int table = (addr >> 10) & 0x03;
+        switch (console->mapper ? console->mapper->mirror : rom::Horizontal)
+        {
+        case rom::Horizontal: table >>= 1; break;
+        case rom::Vertical: table &= 0x01; break;
+        case rom::SingleLow: table = 0; break;
+        case rom::SingleHigh: table = 1; break;
+        case rom::FourScreen: break;
+        }
+        return &vram[(table << 10) | (addr & 0x03FF)];
+    }
+
+    static uint8_t paletteIndex(uint16_t addr)
+    {
+        // 0x3F10/14/18/1C mirror the backdrop entries
+        uint8_t i = addr & 0x1F;
+        if ((i & 0x13) == 0x10)
+            i &= 0x0F;
+        return i;
+    }
+
+    // byte offset into the cartridge CHR for a pattern table address, through the current banks
+    size_t PPU::chrOffset(uint16_t addr)
+    {
+        return (console->mapper->chrBanks[(addr >> 10) & 0x07] - console->bus.chr.data()) + (addr & 0x03FF);
+    }
+
+    uint8_t PPU::read(uint16_t addr)
+    {
+        addr &= 0x3FFF;
+
+        if (addr < 0x2000)
+            return console->mapper ? console->bus.chr[chrOffset(addr)] : 0;
+        if (addr < 0x3F00)
+            return *nametable(addr);
+        return palette[paletteIndex(addr)];
+    }
+
+    void PPU::write(uint16_t addr, uint8_t data)
+    {
+        addr &= 0x3FFF;
+
+        if (addr < 0x2000)
+        {
+            if (console->mapper && console->mapper->chrWritable)
+            {
+                size_t offset = chrOffset(addr);
+                console->bus.chrRam[offset] = data;
+                tiles::update(console->bus.chrRam.data(), decoded, offset);
+            }
+        }
+        else if (addr < 0x3F00)
+            *nametable(addr) = data;
+        else
+            palette[paletteIndex(addr)] = data & 0x3F;
+    }
+
+    void PPU::reset()
+    {
+        regs = {};
+        memset(vram, 0, sizeof(vram));
+        memset(oam, 0, sizeof(oam));
+        memset(palette, 0, sizeof(palette));
+        memset(framebuffer, 0, sizeof(framebuffer));
+
+        scanline = 0;
+        dot = 0;
+        frame = 0;
+        nmi = false;
+    }
+
+    uint8_t PPU::readRegister(uint16_t addr)
+    {
+        switch (addr & 0x07)
+        {
+        case 2:
+        {
+            // low bits are open bus, approximated with the read buffer
+            uint8_t result = (regs.status & 0xE0) | (regs.readBuffer & 0x1F);
+            regs.status &= ~0x80;
+            regs.w = false;
+            return result;
+        }
+        case 4:
+            return oam[regs.oamAddr];
+        case 7:
+        {
+            uint16_t addr = regs.v & 0x3FFF;
+            uint8_t result;
+
+            if (addr < 0x3F00)
+            {
+                result = regs.readBuffer;
+                regs.readBuffer = read(addr);
+            }
+            else
+            {
+                // palette reads are immediate, the buffer gets the nametable "underneath"
+                result = read(addr);
+                regs.readBuffer = read(addr - 0x1000);
+            }
+
+            regs.v += (regs.ctrl & 0x04) ? 32 : 1;
+            return result;
+        }
+        default:
+            // write only registers
+            return regs.readBuffer;
+        }
+    }
+
+    uint8_t PPU::peekRegister(uint16_t addr) const
+    {
+        switch (addr & 0x07)
+        {
+        case 2:
+            return (regs.status & 0xE0) | (regs.readBuffer & 0x1F);
+        case 4:
+            return oam[regs.oamAddr];
+        default:
+            // PPU_DATA shows the buffered byte, what a non palette read hands back next
+            return regs.readBuffer;
+        }
+    }
+
+    void PPU::writeRegister(uint16_t addr, uint8_t data)
+    {
+        switch (addr & 0x07)
+        {
+        case 0:
+            // enabling NMI while already in vblank fires one straight away
+            if (!(regs.ctrl & 0x80) && (data & 0x80) && (regs.status & 0x80))
+                nmi = true;
+
+            regs.ctrl = data;
+            regs.t = (regs.t & 0xF3FF) | ((data & 0x03) << 10);
+            break;
+        case 1:
+            regs.mask = data;
+            break;
+        case 3:
+            regs.oamAddr = data;
+            break;
+        case 4:
+            oam[regs.oamAddr++] = data;
+            break;
+        case 5:
+            if (!regs.w)
+            {
+                regs.t = (regs.t & ~0x001F) | (data >> 3);
+                regs.x = data & 0x07;
+            }
+            else
+                regs.t = (regs.t & ~0x73E0) | ((data & 0x07) << 12) | ((data & 0xF8) << 2);
+            regs.w = !regs.w;
+            break;
+        case 6:
+            if (!regs.w)
+                regs.t = (regs.t & 0x00FF) | ((data & 0x3F) << 8);
+            else
+            {
+                regs.t = (regs.t & 0xFF00) | data;
+                regs.v = regs.t;
+            }
+            regs.w = !regs.w;
+            break;
+        case 7:
+            write(regs.v, data);
+            regs.v += (regs.ctrl & 0x04) ? 32 : 1;
+            break;
+        }
+    }
+
+    void PPU::oamDma(uint8_t page)
+    {
+        uint16_t base = page << 8;
+        for (int i = 0; i < 256; i++)
+            oam[(regs.oamAddr + i) & 0xFF] = console->bus.read(base + i);
+    }
+
+    void PPU::incrementY()
+    {
+        if ((regs.v & 0x7000) != 0x7000)
+        {
+            regs.v += 0x1000; // fine Y
+            return;
+        }
+
+        regs.v &= ~0x7000;
+        int y = (regs.v & 0x03E0) >> 5;
+
+        if (y == 29)
+        {
+            y = 0;
+            regs.v ^= 0x0800; // vertically adjacent nametable
+        }
+        else if (y == 31)
+            y = 0; // attribute rows, wraps without switching nametables
+        else
+            y++;
+
+        regs.v = (regs.v & ~0x03E0) | (y << 5);
+    }
+
+    // decoded pixels of the tile row at a pattern table address
+    uint64_t PPU::chrRow(uint16_t addr)
+    {
+        return decoded[tiles::rowIndex(chrOffset(addr))];
+    }
+
+    // background palette indices (0-15, 0 = transparent) for one scanline
+    void PPU::renderBackground(uint8_t* line)
+    {
+        if (!(regs.mask & 0x08))
+        {
+            memset(line, 0, WIDTH);
+            return;
+        }
+
+        uint16_t v = regs.v;
+        const uint16_t patternBase = (regs.ctrl & 0x10) ? 0x1000 : 0x0000;
+        const int fineY = (v >> 12) & 0x07;
+
+        // 33 whole tiles so fine X scroll still fills the line, the picture starts x pixels in
+        uint8_t tilesLine[33 * 8];
+
+        for (int tile = 0; tile < 33; tile++)
+        {
+            uint8_t index = *nametable(0x2000 | (v & 0x0FFF));
+            uint8_t attr = *nametable(0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+            uint8_t high = ((attr >> (((v >> 4) & 0x04) | (v & 0x02))) & 0x03) << 2;
+
+            // a whole row of 8 pixels in one go
+            uint64_t row = tiles::colorize(chrRow(patternBase + index * 16 + fineY), high);
+            memcpy(&tilesLine[tile * 8], &row, 8);
+
+            // coarse X, wrapping into the horizontally adjacent nametable
+            // done on a local copy, the real v gets its horizontal bits reloaded at dot 257 anyway
+            if ((v & 0x001F) == 31)
+                v = (v & ~0x001F) ^ 0x0400;
+            else
+                v++;
+        }
+
+        memcpy(line, &tilesLine[regs.x], WIDTH);
+
+        if (!(regs.mask & 0x02))
+            memset(line, 0, 8);
+    }
+
+    // sprite palette indices (16-31, 0 = transparent), priority bit in 0x80 and sprite 0 in 0x40
+    // returns false when no sprite touches this line
+    bool PPU::renderSprites(uint8_t* line)
+    {
+        if (!(regs.mask & 0x10))
+            return false;
+
+        memset(line, 0, WIDTH);
+
+        const int height = (regs.ctrl & 0x20) ? 16 : 8;
+        int found = 0;
+
+        for (int i = 0; i < 64; i++)
+        {
+            const uint8_t* sprite = &oam[i * 4];
+
+            // sprites are drawn one line below their Y
+            int row = scanline - (sprite[0] + 1);
+            if (row < 0 || row >= height)
+                continue;
+
+            if (++found > 8)
+            {
+                regs.status |= 0x20; // overflow
+                break;
+            }
+
+            uint8_t tile = sprite[1];
+            uint8_t attr = sprite[2];
+            int x = sprite[3];
+
+            if (attr & 0x80)
+                row = height - 1 - row; // vertical flip
+
+            uint16_t addr;
+            if (height == 16)
+                addr = ((tile & 0x01) << 12) | (((tile & 0xFE) << 4) + (row >= 8 ? 16 : 0) + (row & 0x07));
+            else
+                addr = ((regs.ctrl & 0x08) ? 0x1000 : 0x0000) + tile * 16 + row;
+
+            uint64_t pixels = chrRow(addr);
+            if (attr & 0x40)
+                pixels = tiles::flip(pixels); // horizontal flip
+
+            const uint8_t flags = 0x10 | ((attr & 0x03) << 2) | ((attr & 0x20) ? 0x80 : 0) | (i == 0 ? 0x40 : 0);
+
+            for (int col = 0; col < 8; col++, pixels >>= 8)
+            {
+                int px = x + col;
+                if (px >= WIDTH)
+                    break;
+
+                // earlier sprites win, so skip anything already drawn
+                uint8_t pixel = pixels & 0x03;
+                if (pixel && !line[px])
+                    line[px] = flags | pixel;
+            }
+        }
+
+        if (!(regs.mask & 0x04))
+            memset(line, 0, 8);
+
+        return found > 0;
+    }
+
+    void PPU::renderScanline()
+    {
+        uint32_t* out = &framebuffer[scanline * WIDTH];
+
+        // resolve the palette once per line instead of once per pixel
+        const uint8_t grey = (regs.mask & 0x01) ? 0x30 : 0x3F;
+        uint32_t colors[32];
+        for (int i = 0; i < 32; i++)
+            colors[i] = systemPalette[palette[paletteIndex(i)] & grey];
+
+        if (!rendering() || !console->mapper)
+        {
+            for (int px = 0; px < WIDTH; px++)
+                out[px] = colors[0];
+            return;
+        }
+
+        uint8_t bg[WIDTH];
+        uint8_t sp[WIDTH];
+        renderBackground(bg);
+
+        // most lines have no sprites on them, those are just a palette lookup per pixel
+        if (!renderSprites(sp))
+        {
+            for (int px = 0; px < WIDTH; px++)
+                out[px] = colors[bg[px]];
+            return;
+        }
+
+        for (int px = 0; px < WIDTH; px++)
+        {
+            uint8_t b = bg[px];
+            uint8_t s = sp[px];
+
+            if (!s)
+            {
+                out[px] = colors[b];
+                continue;
+            }
+
+            if ((s & 0x40) && b && px != 255)
+                regs.status |= 0x40; // sprite 0 hit
+
+            // behind-background sprites only show through transparent background
+            out[px] = (b && (s & 0x80)) ? colors[b] : colors[s & 0x1F];
+        }
+    }
+
+    // things that happen at a specific dot of a scanline
+    void PPU::event(int at)
+    {
+        const bool visible = scanline < HEIGHT;
+        const bool preRender = scanline == SCANLINES_PER_FRAME - 1;
+
+        if (at == 1 && scanline == 241)
+        {
+            regs.status |= 0x80; // vblank
+            if (regs.ctrl & 0x80)
+                nmi = true;
+        }
+        else if (at == 1 && preRender)
+            regs.status &= ~0xE0;
+
+        if (visible && at == 256)
+            renderScanline();
+
+        if (!rendering() || !(visible || preRender))
+            return;
+
+        switch (at)
+        {
+        case 256:
+            incrementY();
+            break;
+        case 257:
+            // copy horizontal scroll from t
+            regs.v = (regs.v & ~0x041F) | (regs.t & 0x041F);
+            break;
+        case 260:
+            if (console->mapper)
+                console->mapper->scanline();
+            break;
+        case 280:
+            // pre-render line reloads vertical scroll from t
+            if (preRender)
+                regs.v = (regs.v & ~0x7BE0) | (regs.t & 0x7BE0);
+            break;
+        }
+    }
+
+    int PPU::cyclesToEvent(bool scanlines)
+    {
+        const int frameDots = DOTS_PER_SCANLINE * SCANLINES_PER_FRAME;
+        const int now = scanline * DOTS_PER_SCANLINE + dot;
+
+        // dots until (line, at), always looking forward, a full frame if we're standing on it
+        auto until = [&](int line, int at)
+        {
+            int dots = (line * DOTS_PER_SCANLINE + at - now + frameDots) % frameDots;
+            return dots ? dots : frameDots;
+        };
+
+        int dots = until(241, 1);
+
+        if (scanlines && rendering())
+        {
+            // next dot 260 on a visible or pre-render line
+            int line = dot < 260 ? scanline : scanline + 1;
+            if (line >= HEIGHT && line < SCANLINES_PER_FRAME - 1)
+                line = SCANLINES_PER_FRAME - 1;
+            else if (line == SCANLINES_PER_FRAME)
+                line = 0;
+
+            int next = until(line, 260);
+            if (next < dots)
+                dots = next;
+        }
+
+        // round up, odd frames skipping a dot only ever makes us arrive a little after the event
+        return (dots + 2) / 3;
+    }
+
+    void PPU::clock(int cpuCycles)
+    {
+        static const int events[] = { 1, 256, 257, 260, 280 };
+
+        int dots = cpuCycles * 3;
+
+        while (dots > 0)
+        {
+            // jump straight to the end of the scanline or the budget, firing any events on the way
+            int to = dot + dots;
+            if (to > DOTS_PER_SCANLINE)
+                to = DOTS_PER_SCANLINE;
+
+            for (int at : events)
+                if (dot < at && at <= to)
+                    event(at);
+
+            dots -= to - dot;
+            dot = to;
+
+            if (dot == DOTS_PER_SCANLINE)
+            {
+                dot = 0;
+                scanline++;
+
+                if (scanline == SCANLINES_PER_FRAME)
+                {
+                    scanline = 0;
+                    frame++;
+
+                    // odd frames skip the first dot when rendering
+                    if ((frame & 1) && rendering())
+                        dot = 1;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,91 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    tiles.cpp - 2bpp planar CHR decoding, SSE2 when available
+*/
+
+#include "../headers/gfx/tiles.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TILES_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace tiles
+{
+    // put bit 7-i of b into byte i as 0 or 1
+    static uint64_t spread(uint8_t b)
+    {
+        uint64_t bits = (b * 0x0101010101010101ull) & 0x0102040810204080ull;
+        // any set byte becomes >= 0x80 without carrying into the next one
+        return ((bits + 0x7F7F7F7F7F7F7F7Full) >> 7) & 0x0101010101010101ull;
+    }
+
+    uint64_t decodeRow(uint8_t lo, uint8_t hi)
+    {
+        return spread(lo) | (spread(hi) << 1);
+    }
+
+#ifdef TILES_SSE2
+    // test every byte of r against its own pixel bit, giving `value` where set
+    static __m128i pixels(__m128i r, __m128i bits, __m128i value)
+    {
+        return _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(r, bits), bits), value);
+    }
+
+    void decodeTiles(const uint8_t* src, uint64_t* dst, size_t count)
+    {
+        const __m128i bits = _mm_set_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+                                          0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80);
+        const __m128i one = _mm_set1_epi8(1);
+        const __m128i two = _mm_set1_epi8(2);
+
+        for (size_t t = 0; t < count; t++, src += 16, dst += 8)
+        {
+            // low plane in bytes 0-7, high plane in 8-15
+            __m128i tile = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+
+            // broadcast every plane byte over 8 lanes, two rows per register
+            __m128i lo = _mm_unpacklo_epi8(tile, tile);
+            __m128i hi = _mm_unpackhi_epi8(tile, tile);
+            __m128i lo4[2] = { _mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo) };
+            __m128i hi4[2] = { _mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi) };
+
+            for (int half = 0; half < 2; half++)
+            {
+                __m128i l0 = _mm_unpacklo_epi32(lo4[half], lo4[half]);
+                __m128i l1 = _mm_unpackhi_epi32(lo4[half], lo4[half]);
+                __m128i h0 = _mm_unpacklo_epi32(hi4[half], hi4[half]);
+                __m128i h1 = _mm_unpackhi_epi32(hi4[half], hi4[half]);
+
+                __m128i rows0 = _mm_or_si128(pixels(l0, bits, one), pixels(h0, bits, two));
+                __m128i rows1 = _mm_or_si128(pixels(l1, bits, one), pixels(h1, bits, two));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + half * 4), rows0);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + half * 4 + 2), rows1);
+            }
+        }
+    }
+#else
+    void decodeTiles(const uint8_t* src, uint64_t* dst, size_t count)
+    {
+        for (size_t t = 0; t < count; t++, src += 16, dst += 8)
+            for (int row = 0; row < 8; row++)
+                dst[row] = decodeRow(src[row], src[row + 8]);
+    }
+#endif
+
+    void rebuild(const uint8_t* chr, size_t size, std::vector<uint64_t>& decoded)
+    {
+        const size_t count = size / 16;
+        decoded.assign(count * 8, 0);
+        decodeTiles(chr, decoded.data(), count);
+    }
+
+    void update(const uint8_t* chr, std::vector<uint64_t>& decoded, size_t offset)
+    {
+        const size_t row = offset & ~static_cast<size_t>(0x08);
+        decoded[rowIndex(offset)] = decodeRow(chr[row], chr[row | 0x08]);
+    }
+}
@@ -1,6 +1,11 @@
 #pragma once
 #include <cstdint>
-#include <string>
+#include <array>
+
+namespace memory
+{
+	struct Bus;
+}
 
 namespace cpu
 {
@@ -13,6 +18,15 @@ namespace cpu
 		uint8_t PS; // Processor status
 		uint16_t PC; // Program Counter
 
+		uint64_t cycles; // master clock, CPU cycles since power on. everything else catches up to this
+
+		// extra cycles the running instruction picked up (page crossing, taken branch)
+		// only written by indexed addressing and branches, and only read back for instructions that can be penalized
+		uint8_t penalty;
+
+		// everything the CPU reads and writes goes through here, owned by the console
+		memory::Bus* bus;
+
 		enum flags
 		{
 			N = 0x80, // negative flag
@@ -44,23 +58,23 @@ namespace cpu
 
 		struct instruction
 		{
-			std::string name; // name of instruction
+			const char* name; // name of instruction
 			addressingMode mode; // addressing mode
 			uint8_t size; // size of instruction
 			uint8_t cycles; // cycles needed for runtime
 			bool incrementPc; // some opcodes already alter PC
+			bool penalized; // penalty cycles apply (indexed reads, branches)
 			void (*impl)(CPU& cpu, addressingMode mode); // pointer to implementation
 		};
 
-		instruction instructions[256];
+		// shared by every CPU, built at compile time from opcodes.def
+		static const std::array<instruction, 256> instructions;
 
 		void pushByte(uint16_t value);
 		uint16_t pullByte();
 
 		void setFlag(flags flag, bool value);
 		bool getFlag(flags flag) const;
-
-		void populate();
 	};
 
 	namespace addressing
@@ -168,12 +182,23 @@ namespace cpu
 		void SLO(CPU& c, CPU::addressingMode mode);
 		void SRE(CPU& c, CPU::addressingMode mode);
 		void RRA(CPU& c, CPU::addressingMode mode);
+		void ANC(CPU& c, CPU::addressingMode mode);
 
 		// nop
 		void NOP(CPU& c, CPU::addressingMode mode);
 	}
 
 	void NMI(CPU& c);
-	void populate();
-	CPU* initialize();
+	void IRQ(CPU& c); // doesn't check the I flag, the caller decides whether the line is masked
+
+	// execute the instruction at PC, returns the cycles it took (0 means the opcode is unimplemented)
+	// uses the switch core unless built with ERNESTO_TABLE_DISPATCH
+	uint8_t step(CPU& c);
+
+	// the two cores behind step(), both always built so they can be benchmarked against each other
+	uint8_t stepTable(CPU& c); // function pointer + runtime addressing mode
+	uint8_t stepSwitch(CPU& c); // one case per opcode, addressing mode known at compile time
+
+	// power on register state, leaves bus alone
+	void initialize(CPU& c);
 }
\ No newline at end of file
@@ -0,0 +1,34 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// batch runner, plays a list of ROMs headless across every core
+// each ROM gets its own Console, so runs never see each other. workers take ROMs from their own
+// queue and steal from the others once it's empty, so a few slow ROMs don't leave cores idle
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "headless.h"
+
+namespace emu
+{
+    struct batchResult
+    {
+        std::string path;
+        bool loaded; // false if the file wasn't a ROM we could load, run is empty then
+        bool supported; // false if it loaded but needs a mapper we don't have, run is empty then too
+        result run;
+    };
+
+    // ROMs to run: every .nes file in a directory (sorted), or a manifest with one path per line
+    // (blank lines and lines starting with # are skipped, relative paths are relative to the manifest)
+    std::vector<std::string> batchList(const char* path);
+
+    // run every ROM from its reset vector until it hits a limit, halts or reports a test result
+    // threads = 0 uses every hardware thread. results come back in the order of roms
+    std::vector<batchResult> runBatch(const std::vector<std::string>& roms, const limits& l, unsigned threads = 0,
+        uint8_t (*core)(cpu::CPU&) = cpu::step);
+}
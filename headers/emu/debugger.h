@@ -0,0 +1,125 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// breakpoints, watchpoints and stepping
+// a breakpoint covers an address range and any mix of exec, read and write, optionally with a condition.
+// nothing is checked per access: exec ranges go into a per-page bitmap that's only looked at when armed is
+// set (one branch per instruction otherwise), and read/write ranges have their pages re-routed through a
+// handler by the bus (see Bus::watch), so every other page keeps its direct pointer.
+// the Debugger lives next to the Console and is driven by the frontend's loop, emu::step knows nothing about it
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace emu
+{
+    struct Console;
+
+    enum accessType
+    {
+        Exec = 1,
+        Read = 2,
+        Write = 4
+    };
+
+    // a compiled condition, C-ish: registers (a x y sp pc p), the access (addr, value), [address] for a byte of
+    // memory, numbers ($FF, 0xFF or decimal) and ! ~ - * / % + - & ^ | < <= > >= == != && || with parentheses
+    struct condition
+    {
+        // false with a message in error when it doesn't parse, an empty expression is always true
+        bool compile(const std::string& text, std::string& error);
+
+        // non zero when it holds, memory is peeked so checking has no side effects
+        int64_t evaluate(const Console& console, uint16_t addr, uint8_t value) const;
+
+        bool empty() const { return code.empty(); }
+
+        // reverse polish, evaluated on a small fixed stack
+        struct op
+        {
+            uint8_t kind;
+            int64_t value;
+        };
+
+        std::vector<op> code;
+    };
+
+    struct breakpoint
+    {
+        uint16_t first;
+        uint16_t last;
+        uint8_t access; // accessType bits
+        bool enabled;
+        std::string text; // the condition as typed
+        condition when;
+        uint64_t hits;
+    };
+
+    enum stopReason
+    {
+        NotStopped,
+        Breakpoint,
+        StepDone
+    };
+
+    struct Debugger
+    {
+        std::vector<breakpoint> points;
+
+        // anything to check at all, the frontend tests this before calling beforeInstruction
+        bool armed = false;
+
+        // why and where the last stop happened, hit is set from inside an access and read after the instruction
+        stopReason reason = NotStopped;
+        bool hit = false;
+        size_t hitIndex = 0;
+        uint16_t hitAddress = 0;
+        uint8_t hitValue = 0;
+        accessType hitAccess = Exec;
+
+        // hooks the bus up, detach before the Console goes away
+        void attach(Console& console);
+        void detach();
+
+        // false with error set when the condition doesn't compile
+        bool add(uint16_t first, uint16_t last, uint8_t access, const std::string& text, std::string& error);
+        void remove(size_t i);
+        void enable(size_t i, bool enabled);
+        void clear();
+
+        // run to the instruction after the one at PC, subroutines included
+        void stepOver();
+        // run until the current subroutine returns
+        void stepOut();
+
+        // about to carry on from a stop, the instruction at PC runs even if there's a breakpoint on it
+        void resume();
+
+        // before every instruction while armed, true means stop without running it
+        bool beforeInstruction();
+
+        // from the bus, for watched pages only
+        void access(Console& console, uint16_t addr, uint8_t value, accessType type);
+
+    private:
+        Console* console = nullptr;
+
+        uint64_t execPages[4] = {};
+
+        // stepping: stop before the next instruction, at stepOver's return address, or once stepOut's returns
+        enum { None, Next, Over, Out } stepping = None;
+        uint16_t stepTarget = 0;
+        uint8_t stepStack = 0;
+        uint8_t lastOpcode = 0;
+        bool skip = false;
+
+        bool matches(breakpoint& b, uint16_t addr, uint8_t value, accessType type);
+        void stop(size_t i, uint16_t addr, uint8_t value, accessType type);
+        void rebuild();
+    };
+}
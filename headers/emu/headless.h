@@ -0,0 +1,52 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// headless runner, executes the CPU with no SDL/ImGui attached
+// used for batch runs and measuring raw throughput
+
+#pragma once
+#include <cstdint>
+#include "../cpu/cpu.h"
+
+namespace emu
+{
+    struct Console;
+
+    // NTSC: 341 dots * 262 scanlines / 3 dots per CPU cycle
+    const uint32_t CYCLES_PER_FRAME = 29780;
+
+    // 0 means "no limit", the run stops at whichever limit is hit first
+    struct limits
+    {
+        uint64_t instructions;
+        uint64_t cycles;
+        uint64_t frames;
+
+        // also stop once a test ROM posts its final result at 0x6000, checked once a frame
+        // (0x6001-0x6003 hold DE B0 61, 0x6000 is 0x80 while running and the result code after)
+        bool testStatus;
+    };
+
+    enum haltReason
+    {
+        Completed, // hit one of the limits
+        Unimplemented, // ran into an opcode we don't handle
+        Finished // test ROM reported its result, see status
+    };
+
+    struct result
+    {
+        uint64_t instructions;
+        uint64_t cycles;
+        uint64_t frames;
+        double seconds; // wall time
+        haltReason halt;
+        uint16_t pc; // PC where the run stopped
+        uint8_t status; // test ROM result code when Finished, 0 = passed
+    };
+
+    // core picks the dispatch core, defaults to whatever cpu::step was built with
+    result runHeadless(Console& console, const limits& l, uint8_t (*core)(cpu::CPU&) = cpu::step);
+}
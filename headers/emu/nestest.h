@@ -0,0 +1,45 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// nestest regression runner
+// runs nestest.nes in its automated mode (PC = 0xC000) and compares every instruction against a golden
+// log in the canonical nestest.log format (Nintendulator's), stopping at the first line that differs.
+// the log shipped in rom/ is a baseline recorded from ernesto, not Nintendulator's
+//
+// C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+namespace emu
+{
+    struct Console;
+
+    // write the log line for the instruction about to run at PC into buf, returns chars written
+    // memory values in the disassembly are peeked, formatting never touches I/O registers
+    int nestestLine(Console& console, char* buf, size_t len);
+
+    struct nestestOptions
+    {
+        size_t lines; // compare at most this many lines, 0 = the whole golden log
+        bool registers; // only compare PC, opcode bytes, registers, PPU and cycles, not the disassembly
+        size_t context; // matching lines to show before a divergence (up to 16)
+    };
+
+    struct nestestResult
+    {
+        bool passed;
+        size_t lines; // lines that matched
+        uint8_t official; // nestest's error codes where it left off, only checked after a whole run
+        uint8_t unofficial;
+    };
+
+    // put the console in nestest's automated mode and diff the run against golden, which has to stay alive
+    // during the call. a divergence (or an unimplemented opcode) is reported to out with some context, and a
+    // whole run also fails when nestest itself reports an error
+    nestestResult runNestest(Console& console, const char* golden, size_t goldenSize, const nestestOptions& o, FILE* out);
+}
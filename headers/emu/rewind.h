@@ -0,0 +1,61 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// rewind history
+// keeps the newest save state in full and, for every older frame, the XOR against the frame after it,
+// run-length encoded. consecutive frames barely differ so most deltas are a handful of bytes.
+// going back is undoing the newest delta, running out of space just forgets the oldest one
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace emu
+{
+    struct Console;
+
+    struct rewind
+    {
+        // history is capped by both frame count and bytes of deltas
+        // the delta ring is allocated here, the state buffers on the first push (their size depends on the cartridge)
+        explicit rewind(size_t frames = 3600, size_t capacity = 8 << 20);
+
+        // snapshot the machine, call once per frame on the emulation thread
+        void push(Console& console);
+
+        // go back one frame, false when there's no history left
+        bool step(Console& console);
+
+        void clear();
+
+        // frames we can go back
+        size_t size() const;
+        // bytes of delta storage in use
+        size_t used() const;
+
+    private:
+        struct record
+        {
+            size_t offset;
+            size_t length;
+        };
+
+        // free up room for n bytes in the ring, returns where they go
+        size_t reserve(size_t n);
+        void dropOldest();
+
+        std::vector<uint8_t> ring; // RLE'd deltas, oldest to newest
+        std::vector<record> records; // fixed ring of frames, first is the oldest
+        size_t first;
+        size_t count;
+        size_t head; // end of the newest delta in ring
+        size_t bytes;
+
+        std::vector<uint8_t> current; // newest full state
+        std::vector<uint8_t> next;
+        std::vector<uint8_t> scratch; // encoded delta before it goes into the ring
+    };
+}
@@ -0,0 +1,66 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// save states
+// a flat binary snapshot of everything that isn't the ROM itself, written into a buffer the caller owns
+// so taking one never allocates (cheap enough to do every frame)
+//
+// layout: header { magic "ERNS", uint16 version, uint16 flags (0), uint32 total size, uint32 PRG size, uint32 CHR size }
+// followed by CPU, memory, PPU, APU, scheduler and mapper sections, all native endian
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+
+namespace emu
+{
+    struct Console;
+
+    const uint32_t STATE_MAGIC = 0x534E5245; // "ERNS"
+    const uint16_t STATE_VERSION = 2;
+
+    // one function walks every field for both directions, so save and load can't drift apart
+    // with no buffer it only counts bytes
+    struct stream
+    {
+        uint8_t* data;
+        size_t size;
+        size_t used;
+        bool loading; // data is only ever read from when loading
+        bool ok; // false once something didn't fit
+
+        void bytes(void* field, size_t n)
+        {
+            if (data && used + n <= size)
+            {
+                if (loading)
+                    memcpy(field, data + used, n);
+                else
+                    memcpy(data + used, field, n);
+            }
+            else if (data)
+                ok = false;
+
+            used += n;
+        }
+
+        template <typename T>
+        void value(T& field)
+        {
+            bytes(&field, sizeof(T));
+        }
+    };
+
+    // exact size save() needs for the loaded cartridge
+    size_t stateSize(Console& console);
+
+    // returns the bytes written, 0 if the buffer is too small
+    size_t saveState(Console& console, uint8_t* buffer, size_t size);
+
+    // false (with nothing touched) if the buffer isn't a state of this version taken with the same cartridge
+    bool loadState(Console& console, const uint8_t* buffer, size_t size);
+}
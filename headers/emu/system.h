@@ -0,0 +1,78 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// a whole console: the CPU, its bus and the devices on it
+// the CPU's cycle counter is the master clock, the PPU and APU are lazy and only get run forward ("caught up")
+// when the CPU touches them or when they're about to do something the CPU would notice (NMI, IRQs)
+//
+// there's no global state anywhere, a Console owns everything it runs, so any number of them can
+// live in one process. each one is single threaded, give every thread its own
+
+#pragma once
+#include <cstdint>
+#include "../cpu/cpu.h"
+#include "../mem/ram.h"
+#include "../gfx/ppu.h"
+#include "../snd/apu.h"
+#include "../rom/mapper.h"
+
+namespace emu
+{
+    struct Debugger;
+
+    struct Console
+    {
+        cpu::CPU cpu;
+        memory::Bus bus;
+        ppu::PPU ppu;
+        apu::APU apu;
+
+        // the loaded cartridge, owned, nullptr until one is attached
+        rom::Mapper* mapper;
+
+        // how far the PPU has been run, in CPU cycles
+        uint64_t ppuCycle;
+
+        // CPU cycle at which step() has to sync the PPU again, 0 forces it after the current instruction
+        uint64_t deadline;
+
+        // mapper or APU IRQ asserted as of the last sync, so step() only has to look at the I flag in between
+        bool irqLine;
+
+        // attached by the frontend, watchpoints report to it. nullptr (the default) runs without one
+        Debugger* debugger;
+
+        // powered on, but with no cartridge. it's big (framebuffer, page tables), keep it on the heap
+        Console();
+        ~Console();
+
+        // everything points back at this console, it can't be copied or moved
+        Console(const Console&) = delete;
+        Console& operator=(const Console&) = delete;
+
+        // power on everything (memory, PPU, CPU registers), call before loading a ROM
+        void initialize();
+
+        // bring the PPU and APU up to the CPU, called by the bus before anything that can observe or change their state
+        // mid-instruction, so the access is placed on the last cycle of the running instruction
+        void catchUp();
+
+        // the cycle the running instruction's bus access lands on, its last one
+        uint64_t accessCycle() const;
+
+        // bring the PPU and APU up to the end of the last executed instruction, for the frontend before showing a frame
+        void sync();
+
+        // the CPU and PPU state was just replaced wholesale (save state), treat them as in step from here
+        void resync();
+
+    private:
+        void runPpu(uint64_t to);
+    };
+
+    // run one instruction, syncing the PPU/APU and delivering NMI/IRQ when a deadline is reached
+    // returns the CPU cycles taken (including any interrupt entry and OAM DMA stall), 0 if the opcode is unimplemented
+    uint16_t step(Console& console, uint8_t (*core)(cpu::CPU&) = cpu::step);
+}
@@ -0,0 +1,52 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// fixed size instruction trace, stores raw CPU state and only formats on demand
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "../cpu/cpu.h"
+
+namespace emu
+{
+    struct trace
+    {
+        struct entry
+        {
+            uint64_t cycle; // cycle count before the instruction ran
+            uint16_t PC;
+            uint8_t opcode[3];
+            uint8_t A;
+            uint8_t X;
+            uint8_t Y;
+            uint8_t PS;
+            uint8_t SP;
+        };
+
+        // capacity is rounded up to a power of two so wrapping is a mask
+        explicit trace(size_t capacity = 1 << 16);
+
+        // record the instruction about to run at PC
+        void push(const cpu::CPU& c);
+        void clear();
+
+        // replace the contents with the newest `limit` entries of another trace, or as many as fit
+        void assign(const trace& other, size_t limit);
+
+        // number of entries held, oldest first
+        size_t size() const;
+        const entry& at(size_t i) const;
+
+        // write a nestest-ish line for entry i into buf, returns chars written
+        int format(size_t i, char* buf, size_t len) const;
+
+    private:
+        std::vector<entry> entries;
+        size_t mask;
+        uint64_t count; // total pushes, head is count & mask
+    };
+}
@@ -0,0 +1,58 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// lock free triple buffer, one producer and one consumer
+// the producer always has a slot of its own to fill (back), the consumer always has one to read (front) and
+// the third sits in between holding the newest finished one. publishing and picking up are a single atomic
+// exchange each, so neither side ever waits on the other: a slow consumer just skips the slots it missed,
+// a slow producer leaves the consumer looking at the same slot for longer
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace emu
+{
+    template <typename T>
+    struct triple
+    {
+        triple() = default;
+        triple(const triple&) = delete;
+        triple& operator=(const triple&) = delete;
+
+        // producer side, the slot to fill, stays the same until publish
+        T& back() { return items[backIndex]; }
+
+        // hand the back slot over as the newest and take the middle one to fill next
+        void publish()
+        {
+            backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+        }
+
+        // consumer side, swap in the newest slot if one was published since the last call
+        bool update()
+        {
+            if (!(middle.load(std::memory_order_relaxed) & FRESH))
+                return false;
+
+            frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+            return true;
+        }
+
+        // the slot update last picked up, stays the same until the next update
+        const T& front() const { return items[frontIndex]; }
+
+    private:
+        static const uint8_t INDEX = 0x03;
+        static const uint8_t FRESH = 0x04; // middle holds a slot the consumer hasn't seen yet
+
+        T items[3]{};
+
+        // each side's index on its own cache line, the shared one on a third
+        alignas(64) uint8_t backIndex = 0;
+        alignas(64) std::atomic<uint8_t> middle{ 1 };
+        alignas(64) uint8_t frontIndex = 2;
+    };
+}
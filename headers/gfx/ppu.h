@@ -4,13 +4,100 @@
 */
 
 #pragma once
-#include "../mem/ram.h";
-#include "../cpu/cpu.h";
+#include <cstdint>
+#include <cstddef>
 #include <vector>
 
 using namespace std;
 
+namespace emu
+{
+    struct Console;
+}
+
 namespace ppu
 {
+    const int WIDTH = 256;
+    const int HEIGHT = 240;
+
+    const int DOTS_PER_SCANLINE = 341;
+    const int SCANLINES_PER_FRAME = 262;
+
+    struct registers
+    {
+        uint8_t ctrl; // PPU_CTRL 0x2000
+        uint8_t mask; // PPU_MASK 0x2001
+        uint8_t status; // PPU_STATUS 0x2002
+        uint8_t oamAddr; // OAM_ADDR 0x2003
+
+        // internal "loopy" registers, scroll and VRAM address
+        uint16_t v; // current VRAM address
+        uint16_t t; // temporary VRAM address
+        uint8_t x; // fine X scroll
+        bool w; // first/second write toggle for 0x2005/0x2006
+
+        uint8_t readBuffer; // PPU_DATA reads are delayed by one
+    };
+
+    // 2C02 colours, ARGB
+    extern const uint32_t systemPalette[64];
+
+    struct PPU
+    {
+        registers regs;
+
+        uint8_t vram[0x1000]; // nametables, 2kb normally, 4kb with four screen carts
+        uint8_t oam[0x100]; // 64 sprites, 4 bytes each
+        uint8_t palette[0x20];
+
+        // finished picture, ARGB8888, ready to be copied into a streaming texture
+        uint32_t framebuffer[WIDTH * HEIGHT];
+
+        int scanline; // 0-239 visible, 241 vblank starts, 261 pre-render
+        int dot; // 0-340
+        uint64_t frame;
+
+        // set when the PPU wants an NMI, cleared by whoever delivers it to the CPU
+        bool nmi;
+
+        // pre-decoded copy of the cartridge's CHR (see tiles.h)
+        std::vector<uint64_t> decoded;
+
+        // owner, for the cartridge (CHR, mirroring, scanline counter) and OAM DMA's CPU reads
+        emu::Console* console;
+
+        void reset();
+
+        // CPU side, 0x2000 - 0x2007 (mirrored up to 0x3FFF)
+        uint8_t readRegister(uint16_t addr);
+        void writeRegister(uint16_t addr, uint8_t data);
+
+        // what a read would return, without clearing vblank, the write toggle or moving v
+        uint8_t peekRegister(uint16_t addr) const;
+
+        // 0x4014, copy a 256 byte CPU page into OAM
+        void oamDma(uint8_t page);
+
+        // PPU side bus, 0x0000 - 0x3FFF
+        uint8_t read(uint16_t addr);
+        void write(uint16_t addr, uint8_t data);
+
+        // advance the PPU by the given amount of CPU cycles (3 dots each)
+        void clock(int cpuCycles);
+
+        // CPU cycles until the PPU next does something the CPU would notice without touching a register:
+        // the start of vblank (NMI) and, with scanlines set, the mapper's per-scanline tick
+        int cyclesToEvent(bool scanlines);
 
-}
\ No newline at end of file
+    private:
+        bool rendering();
+        uint8_t* nametable(uint16_t addr);
+        size_t chrOffset(uint16_t addr);
+        uint64_t chrRow(uint16_t addr);
+        void incrementY();
+        void renderBackground(uint8_t* line);
+        bool renderSprites(uint8_t* line);
+        void renderScanline();
+        void event(int at);
+    };
+}
@@ -0,0 +1,51 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// pre-decoded CHR
+// tiles are stored as two 8 byte bit planes, turning a row into pixels is the hot part of rendering
+// so every row is decoded once up front into 8 palette indices (0-3), one per byte, leftmost pixel first
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace tiles
+{
+    // decode a single row from its low and high bit planes
+    uint64_t decodeRow(uint8_t lo, uint8_t hi);
+
+    // decode `count` whole 16 byte tiles into count * 8 rows
+    void decodeTiles(const uint8_t* src, uint64_t* dst, size_t count);
+
+    // decode all of chr into decoded, one 64 bit word per tile row, call after loading a cartridge
+    // it follows the CHR data itself rather than the banks, so bank switching never invalidates it
+    void rebuild(const uint8_t* chr, size_t size, std::vector<uint64_t>& decoded);
+
+    // redecode the row containing this CHR byte, call after a CHR RAM write
+    void update(const uint8_t* chr, std::vector<uint64_t>& decoded, size_t offset);
+
+    // index into decoded for a byte offset into chr (either bit plane)
+    inline size_t rowIndex(size_t offset)
+    {
+        return ((offset >> 4) << 3) | (offset & 0x07);
+    }
+
+    // spread the 2 bit attribute palette over the non-transparent pixels of a decoded row
+    inline uint64_t colorize(uint64_t row, uint8_t high)
+    {
+        // pixels are 0-3, so a pixel is opaque when either of its two low bits is set
+        uint64_t opaque = (row | (row >> 1)) & 0x0101010101010101ull;
+        return row | (opaque * high);
+    }
+
+    // mirror a decoded row, for horizontally flipped sprites
+    inline uint64_t flip(uint64_t row)
+    {
+        row = ((row & 0x00FF00FF00FF00FFull) << 8) | ((row >> 8) & 0x00FF00FF00FF00FFull);
+        row = ((row & 0x0000FFFF0000FFFFull) << 16) | ((row >> 16) & 0x0000FFFF0000FFFFull);
+        return (row << 32) | (row >> 32);
+    }
+}
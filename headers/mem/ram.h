@@ -1,16 +1,129 @@
 #pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
 #include <vector>
 
 using namespace std;
 
-namespace memory 
+namespace emu
 {
-    extern std::vector<uint8_t> internal; // 2kb
-    extern std::vector<uint8_t> ppu;
-    extern std::vector<uint8_t> apu;
-    extern std::vector<uint8_t> prg;
-
-    void initialize();
-    uint8_t read(uint16_t addr);
-    void write(uint16_t addr, uint8_t data);
+    struct Console;
+}
+
+namespace rom
+{
+    struct Image;
+}
+
+namespace memory
+{
+    struct Bus;
+
+    typedef uint8_t (*readHandler)(Bus& bus, uint16_t addr);
+    typedef void (*writeHandler)(Bus& bus, uint16_t addr, uint8_t data);
+
+    // read-only window into memory somebody else owns (ex: a mapped ROM file), indexes like a vector
+    struct span
+    {
+        const uint8_t* ptr;
+        size_t length;
+
+        const uint8_t* data() const { return ptr; }
+        size_t size() const { return length; }
+        bool empty() const { return !length; }
+        uint8_t operator[](size_t i) const { return ptr[i]; }
+    };
+
+    // the CPU address space of one console, plus the memory behind it
+    struct Bus
+    {
+        std::vector<uint8_t> internal; // 2kb
+        std::vector<uint8_t> apu;
+        std::vector<uint8_t> prgRam; // 0x6000 - 0x7FFF, cartridge work RAM
+        std::vector<uint8_t> chrRam; // for carts without CHR ROM
+
+        // PRG and CHR point straight into the cartridge image (chr at chrRam for CHR RAM carts), banked by the mapper
+        span prg;
+        span chr;
+        // keeps the image mapped for as long as the bus points into it
+        std::shared_ptr<const rom::Image> cartridge;
+
+        // one entry per 256 byte page of the CPU address space
+        // pages backed by plain memory get a host pointer, the rest (I/O) go through a handler
+        const uint8_t* readPages[256];
+        uint8_t* writePages[256];
+        readHandler readHandlers[256];
+        writeHandler writeHandlers[256];
+
+        // what read() and write() go through: the tables above, except for pages with a watchpoint on them
+        // (see emu/debugger.h), which go through a handler that reports the access and then does it.
+        // unwatched pages keep their host pointer, so watchpoints cost nothing anywhere else
+        const uint8_t* routeRead[256];
+        uint8_t* routeWrite[256];
+        readHandler routeReadHandlers[256];
+        writeHandler routeWriteHandlers[256];
+
+        // pages with a watchpoint, bit n of word n >> 6. debugger settings, not machine state, so power on keeps them
+        uint64_t watchRead[4] = {};
+        uint64_t watchWrite[4] = {};
+
+        // owner, handlers use it to reach the PPU and the mapper
+        emu::Console* console;
+
+        // one bit per page that may have changed since the debugger last cleared it (bit n of word n >> 6)
+        // a single or on the write path, so the memory viewer only has to look at pages that changed.
+        // remapping a page (bank switches) marks it too, and so does a state load (see Console::resync)
+        uint64_t dirty[4];
+
+        // where writes to ROM and unmapped pages land, nothing ever reads it back
+        // one per bus, consoles on other threads write to their own
+        uint8_t sink[0x100];
+
+        void initialize();
+
+        // point pages [firstPage, firstPage + count) at host memory, mirrored every `size` bytes
+        // read-only mappings drop writes
+        void map(uint8_t firstPage, int count, uint8_t* host, size_t size, bool writable);
+        // same, but only touches the read side (ex: PRG banks, whose writes go to the mapper)
+        void mapRead(uint8_t firstPage, int count, const uint8_t* host, size_t size);
+        // route pages [firstPage, firstPage + count) through handlers instead
+        void mapHandlers(uint8_t firstPage, int count, readHandler r, writeHandler w);
+        void mapWriteHandler(uint8_t firstPage, int count, writeHandler w);
+
+        // replace the watched pages and rebuild the routes
+        void watch(const uint64_t read[4], const uint64_t write[4]);
+
+        // read for debuggers and the trace, never has side effects or trips a watchpoint
+        // (I/O registers return what they hold, see ram.cpp)
+        inline uint8_t peek(uint16_t addr) const
+        {
+            const uint8_t* page = readPages[addr >> 8];
+            return page ? page[addr & 0xFF] : peekRegister(addr);
+        }
+
+        inline uint8_t read(uint16_t addr)
+        {
+            const uint8_t* page = routeRead[addr >> 8];
+            if (page)
+                return page[addr & 0xFF];
+            return routeReadHandlers[addr >> 8](*this, addr);
+        }
+
+        inline void write(uint16_t addr, uint8_t data)
+        {
+            uint8_t* page = routeWrite[addr >> 8];
+            dirty[addr >> 14] |= 1ull << ((addr >> 8) & 63);
+            if (page)
+                page[addr & 0xFF] = data;
+            else
+                routeWriteHandlers[addr >> 8](*this, addr, data);
+        }
+
+    private:
+        uint8_t peekRegister(uint16_t addr) const;
+
+        // copy pages [firstPage, firstPage + count) from the mapping into the routes
+        void reroute(int firstPage, int count);
+    };
 }
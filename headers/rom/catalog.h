@@ -0,0 +1,52 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// ROM catalog
+// every .nes file under a directory with its header and content hashes, kept in an index file next to it
+// so only files whose size or modification time changed get opened again. hashing runs on every core
+//
+// index layout: magic "ERNC", uint16 version, uint32 count, then one record per ROM, all native endian
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "rom.h"
+
+namespace rom
+{
+    const uint32_t CATALOG_MAGIC = 0x434E5245; // "ERNC"
+    const uint16_t CATALOG_VERSION = 1;
+
+    // CRC-32 (the zip/No-Intro one), pass the previous result to continue over more data
+    uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
+
+    // XXH64, much faster than the CRC and what the catalog uses to spot duplicates
+    uint64_t xxh64(const uint8_t* data, size_t size, uint64_t seed = 0);
+
+    struct catalogEntry
+    {
+        std::string path;
+        uint64_t size; // file size and modification time, a change in either means rehashing
+        int64_t mtime;
+        bool valid; // false if the loader rejected it, kept so it isn't retried every startup
+        header info;
+        uint32_t crc; // PRG + CHR without the header, what ROM databases key on
+        uint32_t prgCrc;
+        uint64_t hash; // xxh64 of PRG + CHR
+    };
+
+    struct catalog
+    {
+        std::vector<catalogEntry> entries; // sorted by path
+        size_t hashed; // files (re)opened by this scan, the rest came from the index
+        bool saved; // index written, false if it couldn't be or nothing changed
+    };
+
+    // scan dir (recursively) for .nes files, reusing whatever index has for unchanged ones, and update index
+    // threads = 0 uses every hardware thread
+    catalog scanCatalog(const char* dir, const char* index, unsigned threads = 0);
+}
@@ -0,0 +1,75 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// cartridge mappers
+// bank switching never copies memory, it just repoints pages of the CPU bus (and CHR banks for the PPU)
+
+#pragma once
+#include <cstdint>
+
+namespace emu
+{
+    struct stream;
+    struct Console;
+}
+
+namespace memory
+{
+    struct Bus;
+}
+
+namespace rom
+{
+    enum mirroring
+    {
+        Horizontal,
+        Vertical,
+        SingleLow, // one screen, first nametable
+        SingleHigh, // one screen, second nametable
+        FourScreen
+    };
+
+    struct Mapper
+    {
+        // PPU side, 1kb CHR banks covering 0x0000 - 0x1FFF
+        const uint8_t* chrBanks[8];
+        bool chrWritable; // CHR RAM carts, bus.chr is then bus.chrRam
+        mirroring mirror;
+
+        // raised by mappers with a scanline counter (MMC3), the CPU acknowledges it
+        bool irq;
+        // set while that counter can raise irq, the PPU then has to be kept current every scanline
+        bool scanlineIrq;
+
+        // the console's bus, banks are mapped into its page table and point into its PRG/CHR
+        memory::Bus* bus;
+
+        virtual ~Mapper() {}
+
+        // set up the power-on bank layout
+        virtual void reset() = 0;
+
+        // CPU write to 0x8000 - 0xFFFF
+        virtual void write(uint16_t addr, uint8_t data) {}
+
+        // called by the PPU once per rendered scanline
+        virtual void scanline() {}
+
+        // save/load the mapper's own registers, re-applying the banks when loading
+        virtual void state(emu::stream& s) {}
+
+    protected:
+        // map a `size` byte PRG bank at addr, negative banks count from the end (-1 is the last one)
+        void setPrg(uint16_t addr, uint32_t size, int bank);
+        // map `count` 1kb CHR banks starting at slot, bank is in units of count kb
+        void setChr(int slot, int count, int bank);
+    };
+
+    // create the mapper for an iNES/NES 2.0 mapper number, nullptr if unsupported
+    Mapper* createMapper(int number);
+
+    // make m the console's mapper (takes ownership), reset it and hook it into the CPU bus
+    void attach(emu::Console& console, Mapper* m);
+}
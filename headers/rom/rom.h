@@ -4,21 +4,80 @@
 */
 
 // basic (bad) ROM loader (?)
-// uses the NES 2.0 format
+// uses the NES 2.0 format, plain iNES headers are read as well
+// the file is memory mapped and PRG/CHR are handed to the bus as pointers into the mapping, nothing is copied
 
 #pragma once
 #include <cstdint>
-#include <vector>
+#include <cstddef>
+#include <memory>
+#include "../mem/ram.h"
+
+namespace emu
+{
+    struct Console;
+}
 
 namespace rom
 {
-    struct ROM
+    enum timing
+    {
+        NTSC,
+        PAL,
+        MultiRegion,
+        Dendy
+    };
+
+    // everything the 16 byte header says, sizes in bytes
+    struct header
+    {
+        bool nes2; // NES 2.0, otherwise iNES (sizes the old format can't express are guessed)
+        int mapper;
+        int submapper; // always 0 on iNES
+        bool vertical; // nametable arrangement, when the mapper doesn't control it
+        bool fourScreen;
+        bool battery; // PRG RAM (or NVRAM) is battery backed
+        bool trainer; // 512 bytes before PRG
+        size_t prgRom;
+        size_t chrRom;
+        size_t prgRam; // volatile
+        size_t prgNvram;
+        size_t chrRam;
+        size_t chrNvram;
+        timing region;
+    };
+
+    // parse and sanity check a header, false if it isn't one
+    bool parseHeader(const uint8_t* data, size_t size, header& h);
+
+    // a mapped ROM file, shared by every console running it and unmapped with the last one
+    struct Image
     {
-        std::vector<uint8_t> header; // 16-byte header
-        std::vector<uint8_t> trainer;
-        std::vector<uint8_t> prg;
-        std::vector<uint8_t> chr;
+        header info;
+        memory::span trainer;
+        memory::span prg;
+        memory::span chr; // empty on CHR RAM carts
+
+        Image() = default;
+        Image(const Image&) = delete;
+        Image& operator=(const Image&) = delete;
+        ~Image();
+
+    private:
+        friend std::shared_ptr<const Image> load(const char* path);
+
+        const uint8_t* base = nullptr;
+        size_t length = 0;
     };
 
-    void testLoad();
-}
\ No newline at end of file
+    // map a ROM file and validate it, nullptr if it can't be opened, isn't iNES/NES 2.0 or is truncated
+    std::shared_ptr<const Image> load(const char* path);
+
+    // put a cartridge in the console: map PRG/CHR into its bus and attach the mapper
+    // false (console untouched) if its mapper isn't one we have
+    bool insert(emu::Console& console, std::shared_ptr<const Image> image);
+
+    // load a cartridge into the console and attach its mapper
+    // false (console untouched) if the file can't be read, isn't an iNES/NES 2.0 image or needs a mapper we don't have
+    bool testLoad(emu::Console& console, const char* path = "rom/nestest.nes");
+}
@@ -0,0 +1,180 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// 2A03 APU: two pulses, triangle, noise, DMC and the frame counter
+// lazy like the PPU, it's only run forward when the CPU touches 0x4000 - 0x4017, on sync, or when an IRQ
+// of its own is due. instead of ticking every cycle it jumps from one timer expiry to the next, and every
+// change of the mixed output goes into a blip buffer as a band-limited step. samples come out at the host
+// rate into a ring the audio callback drains, with no output set nothing is mixed at all (headless)
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "blip.h"
+#include "ring.h"
+
+namespace emu
+{
+    struct Console;
+    struct stream;
+}
+
+namespace apu
+{
+    const double CPU_RATE = 1789773.0; // NTSC
+
+    // a timer that isn't running, channels that can't be heard don't get clocked
+    const uint64_t IDLE = ~0ull;
+
+    struct envelope
+    {
+        bool start;
+        bool loop; // also halts the length counter
+        bool constant;
+        uint8_t volume; // constant volume, or the decay period
+        uint8_t divider;
+        uint8_t decay;
+    };
+
+    struct pulseChannel
+    {
+        bool enabled;
+        uint8_t duty;
+        uint8_t step;
+        uint16_t timer;
+        uint8_t length;
+        envelope env;
+
+        bool sweepEnabled;
+        bool sweepNegate;
+        bool sweepReload;
+        uint8_t sweepPeriod;
+        uint8_t sweepShift;
+        uint8_t sweepDivider;
+
+        uint64_t next; // CPU cycle of the next timer expiry
+    };
+
+    struct triangleChannel
+    {
+        bool enabled;
+        bool control; // halts the length counter, keeps the linear counter reloading
+        bool linearReload;
+        uint8_t linearPeriod;
+        uint8_t linear;
+        uint16_t timer;
+        uint8_t length;
+        uint8_t step;
+        uint64_t next;
+    };
+
+    struct noiseChannel
+    {
+        bool enabled;
+        bool mode; // short (93 step) sequence
+        uint8_t period;
+        uint16_t shift;
+        uint8_t length;
+        envelope env;
+        uint64_t next;
+    };
+
+    struct dmcChannel
+    {
+        bool irqEnabled;
+        bool loop;
+        bool irq;
+        uint8_t rate;
+        uint8_t output; // 7 bit level
+        uint16_t sampleAddress;
+        uint16_t sampleLength;
+        uint16_t address;
+        uint16_t remaining;
+        uint8_t buffer;
+        bool bufferFull;
+        uint8_t shift;
+        uint8_t bits;
+        bool silence;
+        uint64_t next;
+    };
+
+    struct frameCounter
+    {
+        bool fiveStep;
+        bool inhibit; // no frame IRQ
+        bool irq;
+        uint8_t step;
+        uint64_t start; // CPU cycle the current sequence started at
+        uint64_t next;
+    };
+
+    struct APU
+    {
+        pulseChannel pulse[2];
+        triangleChannel triangle;
+        noiseChannel noise;
+        dmcChannel dmc;
+        frameCounter frame;
+
+        // CPU cycles run so far
+        uint64_t time;
+
+        // host side, none of this is part of a save state
+        // where samples go, nullptr skips mixing altogether
+        ring<int16_t>* output;
+
+        // owner, the DMC reads samples through its bus
+        emu::Console* console;
+
+        APU();
+
+        // power on, everything silent and the clock at 0
+        void reset();
+
+        // the state was just replaced (save state), start synthesis over from here
+        void resync();
+
+        // host sample rate, also drops whatever hasn't been read yet
+        void setRate(double sampleRate);
+
+        // produce ratio times as many samples as the host rate asks for, without dropping anything.
+        // the frontend nudges this by a fraction of a percent to keep its ring at a steady fill level
+        void setRatio(double ratio);
+
+        // CPU side, 0x4000 - 0x4013, 0x4015 and 0x4017
+        void writeRegister(uint16_t addr, uint8_t data);
+        uint8_t readStatus();
+
+        // run up to this CPU cycle
+        void run(uint64_t to);
+
+        // IRQ line, frame counter or DMC
+        bool irq() const { return frame.irq || dmc.irq; }
+
+        // the earliest CPU cycle an IRQ could be raised at, IDLE if none can
+        uint64_t nextIrq() const;
+
+        void state(emu::stream& s);
+
+    private:
+        blip synth;
+        double sampleRate; // host rate from setRate, before the ratio
+        uint64_t synthStart; // CPU cycle the blip frame started at
+        int amplitude; // last mixed level handed to synth
+
+        void quarterFrame();
+        void halfFrame();
+        void frameStep();
+        void clockPulse(int i);
+        void clockTriangle();
+        void clockNoise();
+        void clockDmc();
+        void fetchSample();
+        void schedule();
+        int mix() const;
+        void updateOutput();
+        void flush();
+    };
+}
@@ -0,0 +1,49 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// band-limited synthesis (blip buffer style)
+// the APU never produces samples itself, it only reports when its output level changes, in CPU cycles.
+// every change is drawn into the sample buffer as a band-limited step (a windowed sinc impulse picked
+// from one of PHASES sub-sample offsets), and reading integrates those back into a waveform. square waves
+// come out without aliasing at any host rate, and a channel that holds its level costs nothing
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace apu
+{
+    struct blip
+    {
+        explicit blip(size_t capacity = 4096);
+
+        // input clock (the CPU's) and output sample rate, clears the buffer
+        void setRates(double clockRate, double sampleRate);
+        void clear();
+
+        // same, but keeps what's buffered. only between frames, deltas already drawn used the old rate
+        void adjustRates(double clockRate, double sampleRate);
+
+        // the output level moved by delta at `time` clocks after the start of the current frame
+        void addDelta(uint32_t time, int delta);
+
+        // the frame is `clocks` long, its samples become readable and the next frame starts where it ended
+        void endFrame(uint32_t clocks);
+
+        // samples ready to be read
+        size_t available() const { return ready; }
+
+        // take up to count samples, returns how many were written
+        size_t read(int16_t* out, size_t count);
+
+    private:
+        std::vector<int32_t> buffer; // deltas, integrated when read
+        uint64_t factor; // output samples per clock, 32.32 fixed point
+        uint64_t offset; // start of the current frame in the buffer, 32.32 fixed point
+        size_t ready;
+        int64_t sum; // integrator, carried between reads
+    };
+}
@@ -0,0 +1,86 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+*/
+
+// single producer, single consumer ring buffer, no locks
+// the emulation pushes samples, the audio callback pops them (the frontend also posts UI commands to the
+// emulation thread through one). neither side ever waits: a full ring drops
+// what doesn't fit, an empty one hands back fewer items than asked for. each side keeps a cached copy of
+// the other's index, so the shared cache line is only read when the cached one says the ring is full/empty
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace apu
+{
+    template <typename T>
+    struct ring
+    {
+        // capacity is rounded up to a power of two
+        explicit ring(size_t capacity)
+        {
+            size_t size = 1;
+            while (size < capacity)
+                size <<= 1;
+            items.resize(size);
+            mask = size - 1;
+        }
+
+        ring(const ring&) = delete;
+        ring& operator=(const ring&) = delete;
+
+        // producer side, returns how many fit
+        size_t push(const T* data, size_t count)
+        {
+            const size_t h = head.load(std::memory_order_relaxed);
+
+            if (items.size() - (h - cachedTail) < count)
+                cachedTail = tail.load(std::memory_order_acquire);
+
+            const size_t n = std::min(count, items.size() - (h - cachedTail));
+            for (size_t i = 0; i < n; i++)
+                items[(h + i) & mask] = data[i];
+
+            head.store(h + n, std::memory_order_release);
+            return n;
+        }
+
+        // consumer side, returns how many were there
+        size_t pop(T* data, size_t count)
+        {
+            const size_t t = tail.load(std::memory_order_relaxed);
+
+            if (cachedHead - t < count)
+                cachedHead = head.load(std::memory_order_acquire);
+
+            const size_t n = std::min(count, cachedHead - t);
+            for (size_t i = 0; i < n; i++)
+                data[i] = items[(t + i) & mask];
+
+            tail.store(t + n, std::memory_order_release);
+            return n;
+        }
+
+        // items waiting, exact only on the consumer side (the producer may be adding more)
+        size_t size() const
+        {
+            return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+        }
+
+        size_t capacity() const { return items.size(); }
+
+    private:
+        std::vector<T> items;
+        size_t mask;
+
+        // each index on its own cache line, next to the copy of the other one its side uses
+        alignas(64) std::atomic<size_t> head{ 0 };
+        size_t cachedTail = 0;
+        alignas(64) std::atomic<size_t> tail{ 0 };
+        size_t cachedHead = 0;
+    };
+}
@@ -5,73 +5,229 @@
     ram.cpp - handle memory (RAM) related actions, write/read etc
 */
 
-#include "../headers/mem/ram.h";
-#include "../headers/gfx/ppu.h";
+#include "../headers/mem/ram.h"
+#include "../headers/emu/system.h"
+#include "../headers/emu/debugger.h"
+#include <algorithm>
+#include <cstdio>
 
 namespace memory {
-    std::vector<uint8_t> internal(0x0800); // 2kb
-    std::vector<uint8_t> ppu(0x8);
-    std::vector<uint8_t> apu(0x20);
-    std::vector<uint8_t> prg;
+    // unmapped pages read as 0 and swallow writes (into the bus' own sink)
+    // read only, so sharing it between every bus is fine
+    static const uint8_t openBus[0x100] = {};
+    // PRG of an empty slot
+    static const uint8_t blank[0x8000] = {};
 
-    void initialize()
+    static uint8_t ppuRead(Bus& bus, uint16_t addr)
     {
-        // init space for 2048 (2kb)
-        // could improve mapping (?)
-        // basically seperate memory blocks for easier 
-        internal.resize(0x0800);
-        ppu.resize(8);
-        apu.resize(0x20);
-        prg.resize(0x8000);
+        // handle PPU reads, 8 registers mirrored up to 0x3FFF
+        // the PPU only runs when somebody looks at it, so bring it up to date first
+        bus.console->catchUp();
+        return bus.console->ppu.readRegister(addr);
+    }
 
-        std::fill(internal.begin(), internal.end(), 0xFF);
+    static void ppuWrite(Bus& bus, uint16_t addr, uint8_t data)
+    {
+        // handle PPU writes
+        bus.console->catchUp();
+        bus.console->ppu.writeRegister(addr, data);
     }
 
-    void write(uint16_t addr, uint8_t data)
+    // the APU's registers, 0x4014 (OAM DMA) and 0x4016 (controllers) sit in between
+    static bool apuRegister(uint16_t addr)
     {
-        // write to desired address
-        if (addr < 0x2000)
+        return addr < 0x4014 || addr == 0x4015 || addr == 0x4017;
+    }
+
+    static uint8_t ioRead(Bus& bus, uint16_t addr)
+    {
+        if (addr == 0x4015)
         {
-            if (data == 0x59 && addr == 0x00)
-            {
-                printf("hi");
-            }
-            internal[addr % 0x0800] = data;
+            bus.console->catchUp();
+            return bus.console->apu.readStatus();
         }
-        else if ((addr >= 0x2000 && addr <= 0x3FFF))
+        if (addr < 0x4020 && addr != 0x4014)
+            return bus.apu[addr - 0x4000];
+        return 0;
+    }
+
+    static void ioWrite(Bus& bus, uint16_t addr, uint8_t data)
+    {
+        if (addr == 0x4014)
         {
-            const uint16_t reg = (addr - 0x2000) % 8;
-            // handle PPU writes
-            ppu[reg] = data;
+            emu::Console& console = *bus.console;
+            console.catchUp();
+            console.ppu.oamDma(data);
+
+            // the CPU sits the copy out: a cycle to halt, 512 to read and write, and one more to line up
+            // with a read cycle when the instruction ends on an odd one
+            console.cpu.cycles += 513 + ((console.accessCycle() + 1) & 1);
         }
         else if (addr < 0x4020)
-            apu[addr - 0x4000] = data;
+        {
+            // the raw value stays readable for everything that isn't emulated yet (controllers)
+            bus.apu[addr - 0x4000] = data;
+
+            if (apuRegister(addr))
+            {
+                bus.console->catchUp();
+                bus.console->apu.writeRegister(addr, data);
+            }
+        }
+    }
+
+    uint8_t Bus::peekRegister(uint16_t addr) const
+    {
+        // no catch up either, the PPU is shown where it last stopped
+        if (addr < 0x4000)
+            return console->ppu.peekRegister(addr);
+
+        // raw values, 0x4015 included (reading it for real clears the frame IRQ)
+        if (addr < 0x4020 && addr != 0x4014)
+            return apu[addr - 0x4000];
+        return 0;
+    }
+
+    static bool watched(const uint64_t* pages, int page)
+    {
+        return (pages[page >> 6] >> (page & 63)) & 1;
+    }
+
+    // a watched page's accesses, reported and then done through the real mapping
+    static uint8_t watchedRead(Bus& bus, uint16_t addr)
+    {
+        const uint8_t* page = bus.readPages[addr >> 8];
+        const uint8_t data = page ? page[addr & 0xFF] : bus.readHandlers[addr >> 8](bus, addr);
+
+        if (emu::Debugger* debugger = bus.console->debugger)
+            debugger->access(*bus.console, addr, data, emu::Read);
+        return data;
+    }
+
+    static void watchedWrite(Bus& bus, uint16_t addr, uint8_t data)
+    {
+        if (emu::Debugger* debugger = bus.console->debugger)
+            debugger->access(*bus.console, addr, data, emu::Write);
+
+        uint8_t* page = bus.writePages[addr >> 8];
+        if (page)
+            page[addr & 0xFF] = data;
         else
-            return;
+            bus.writeHandlers[addr >> 8](bus, addr, data);
     }
 
-    uint8_t read(uint16_t addr)
+    void Bus::reroute(int firstPage, int count)
     {
-        if (addr < 0x2000)
-            return internal[addr % 0x0800];
-        else if (addr < 0x4000)
-            // handle PPU reads
-            return ppu[(addr - 0x2000) % 8];
-        else if (addr < 0x4020)
+        for (int page = firstPage; page < firstPage + count; page++)
+        {
+            const bool r = watched(watchRead, page);
+            const bool w = watched(watchWrite, page);
+
+            routeRead[page] = r ? nullptr : readPages[page];
+            routeReadHandlers[page] = r ? watchedRead : readHandlers[page];
+            routeWrite[page] = w ? nullptr : writePages[page];
+            routeWriteHandlers[page] = w ? watchedWrite : writeHandlers[page];
+
+            // whatever the page shows now may be different memory altogether
+            dirty[page >> 6] |= 1ull << (page & 63);
+        }
+    }
+
+    void Bus::watch(const uint64_t read[4], const uint64_t write[4])
+    {
+        std::copy(read, read + 4, watchRead);
+        std::copy(write, write + 4, watchWrite);
+        reroute(0, 256);
+    }
+
+    void Bus::map(uint8_t firstPage, int count, uint8_t* host, size_t size, bool writable)
+    {
+        mapRead(firstPage, count, host, size);
+
+        for (int i = 0; i < count; i++)
+        {
+            size_t offset = (static_cast<size_t>(i) << 8) % size;
+            writePages[firstPage + i] = writable ? host + offset : sink;
+        }
+        reroute(firstPage, count);
+    }
+
+    void Bus::mapRead(uint8_t firstPage, int count, const uint8_t* host, size_t size)
+    {
+        for (int i = 0; i < count; i++)
         {
-            if (addr == 0x4014)
-                return 0;
-            else
-                return apu[addr - 0x4000];
+            size_t offset = (static_cast<size_t>(i) << 8) % size;
+            readPages[firstPage + i] = host + offset;
         }
-        else if (addr >= 0x8000)
+        reroute(firstPage, count);
+    }
+
+    void Bus::mapHandlers(uint8_t firstPage, int count, readHandler r, writeHandler w)
+    {
+        for (int i = 0; i < count; i++)
         {
-            size_t offset = addr - 0x8000;
-            if (prg.size() == 0x4000)
-                offset = offset % 0x4000;
-            return prg[offset];
+            readPages[firstPage + i] = nullptr;
+            writePages[firstPage + i] = nullptr;
+            readHandlers[firstPage + i] = r;
+            writeHandlers[firstPage + i] = w;
         }
-        else
-            return 0;
+        reroute(firstPage, count);
+    }
+
+    void Bus::mapWriteHandler(uint8_t firstPage, int count, writeHandler w)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            writePages[firstPage + i] = nullptr;
+            writeHandlers[firstPage + i] = w;
+        }
+        reroute(firstPage, count);
+    }
+
+    void Bus::initialize()
+    {
+        // init space for 2048 (2kb)
+        // basically seperate memory blocks for easier mapping
+        internal.resize(0x0800);
+        apu.resize(0x20);
+        prgRam.resize(0x2000);
+
+        // no cartridge yet, 32kb of zeroes and 8kb of CHR RAM
+        if (!prg.data())
+            prg = { blank, sizeof(blank) };
+        if (!chr.data())
+        {
+            chrRam.resize(0x2000);
+            chr = { chrRam.data(), chrRam.size() };
+        }
+
+        std::fill(internal.begin(), internal.end(), 0xFF);
+        std::fill(dirty, dirty + 4, ~0ull);
+
+        // 0x4100 - 0x5FFF, nothing there (yet)
+        for (int page = 0; page < 256; page++)
+        {
+            readPages[page] = openBus;
+            writePages[page] = sink;
+            readHandlers[page] = nullptr;
+            writeHandlers[page] = nullptr;
+        }
+        reroute(0, 256);
+
+        // 0x0000 - 0x1FFF, 2kb internal RAM mirrored 4 times
+        map(0x00, 0x20, internal.data(), internal.size(), true);
+
+        // 0x2000 - 0x3FFF, PPU registers
+        mapHandlers(0x20, 0x20, ppuRead, ppuWrite);
+
+        // 0x4000 - 0x40FF, APU and I/O registers
+        mapHandlers(0x40, 0x01, ioRead, ioWrite);
+
+        // 0x6000 - 0x7FFF, cartridge RAM
+        map(0x60, 0x20, prgRam.data(), prgRam.size(), true);
+
+        // 0x8000 - 0xFFFF, PRG ROM, 16kb carts get mirrored
+        // the mapper takes over this range once a cartridge is loaded
+        mapRead(0x80, 0x80, prg.data(), prg.size());
     }
 }
\ No newline at end of file
@@ -0,0 +1,388 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    catalog.cpp - ROM library scan, content hashes and the on-disk index
+*/
+
+#include "../headers/rom/catalog.h"
+#include "../headers/emu/state.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+namespace rom
+{
+    // slice-by-8, eight table lookups per 8 bytes instead of one per byte
+    struct crcTables
+    {
+        uint32_t t[8][256];
+
+        crcTables()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = (c >> 1) ^ (c & 1 ? 0xEDB88320 : 0);
+                t[0][i] = c;
+            }
+
+            for (int k = 1; k < 8; k++)
+                for (int i = 0; i < 256; i++)
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+        }
+    };
+
+    // both hashes read little endian words
+    static inline uint32_t read32(const uint8_t* p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static inline uint64_t read64(const uint8_t* p)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc)
+    {
+        static const crcTables tables;
+        const uint32_t (*t)[256] = tables.t;
+
+        crc = ~crc;
+
+        for (; size >= 8; data += 8, size -= 8)
+        {
+            const uint32_t one = read32(data) ^ crc;
+            const uint32_t two = read32(data + 4);
+            crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+                t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        }
+
+        for (; size; data++, size--)
+            crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+
+        return ~crc;
+    }
+
+    static const uint64_t PRIME1 = 11400714785074694791ull;
+    static const uint64_t PRIME2 = 14029467366897019727ull;
+    static const uint64_t PRIME3 = 1609587929392839161ull;
+    static const uint64_t PRIME4 = 9650029242287828579ull;
+    static const uint64_t PRIME5 = 2870177450012600261ull;
+
+    static inline uint64_t rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    static inline uint64_t xxRound(uint64_t acc, uint64_t input)
+    {
+        acc += input * PRIME2;
+        return rotl(acc, 31) * PRIME1;
+    }
+
+    static inline uint64_t xxMerge(uint64_t acc, uint64_t v)
+    {
+        acc ^= xxRound(0, v);
+        return acc * PRIME1 + PRIME4;
+    }
+
+    uint64_t xxh64(const uint8_t* data, size_t size, uint64_t seed)
+    {
+        const uint8_t* end = data + size;
+        uint64_t h;
+
+        if (size >= 32)
+        {
+            // four independent lanes, so the multiplies overlap
+            uint64_t v1 = seed + PRIME1 + PRIME2;
+            uint64_t v2 = seed + PRIME2;
+            uint64_t v3 = seed;
+            uint64_t v4 = seed - PRIME1;
+
+            for (; end - data >= 32; data += 32)
+            {
+                v1 = xxRound(v1, read64(data));
+                v2 = xxRound(v2, read64(data + 8));
+                v3 = xxRound(v3, read64(data + 16));
+                v4 = xxRound(v4, read64(data + 24));
+            }
+
+            h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+            h = xxMerge(h, v1);
+            h = xxMerge(h, v2);
+            h = xxMerge(h, v3);
+            h = xxMerge(h, v4);
+        }
+        else
+            h = seed + PRIME5;
+
+        h += size;
+
+        for (; end - data >= 8; data += 8)
+            h = rotl(h ^ xxRound(0, read64(data)), 27) * PRIME1 + PRIME4;
+
+        if (end - data >= 4)
+        {
+            h = rotl(h ^ (read32(data) * PRIME1), 23) * PRIME2 + PRIME3;
+            data += 4;
+        }
+
+        for (; data < end; data++)
+            h = rotl(h ^ (*data * PRIME5), 11) * PRIME1;
+
+        h ^= h >> 33;
+        h *= PRIME2;
+        h ^= h >> 29;
+        h *= PRIME3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    // index fields, through the same stream save states use so reading and writing can't drift apart
+    static void size64(emu::stream& s, size_t& field)
+    {
+        uint64_t v = field;
+        s.value(v);
+        field = static_cast<size_t>(v);
+    }
+
+    static void text(emu::stream& s, std::string& field)
+    {
+        uint32_t n = static_cast<uint32_t>(field.size());
+        s.value(n);
+
+        if (s.loading)
+        {
+            // a damaged count must not turn into a huge allocation
+            if (n > s.size - std::min(s.used, s.size))
+            {
+                s.ok = false;
+                return;
+            }
+            field.resize(n);
+        }
+
+        s.bytes(&field[0], n);
+    }
+
+    static void transfer(emu::stream& s, catalogEntry& e)
+    {
+        header& h = e.info;
+
+        text(s, e.path);
+        s.value(e.size);
+        s.value(e.mtime);
+        s.value(e.valid);
+
+        s.value(h.nes2);
+        s.value(h.mapper);
+        s.value(h.submapper);
+        s.value(h.vertical);
+        s.value(h.fourScreen);
+        s.value(h.battery);
+        s.value(h.trainer);
+        size64(s, h.prgRom);
+        size64(s, h.chrRom);
+        size64(s, h.prgRam);
+        size64(s, h.prgNvram);
+        size64(s, h.chrRam);
+        size64(s, h.chrNvram);
+        s.value(h.region);
+
+        s.value(e.crc);
+        s.value(e.prgCrc);
+        s.value(e.hash);
+    }
+
+    static void transfer(emu::stream& s, std::vector<catalogEntry>& entries)
+    {
+        uint32_t magic = CATALOG_MAGIC;
+        uint16_t version = CATALOG_VERSION;
+        uint32_t count = static_cast<uint32_t>(entries.size());
+
+        s.value(magic);
+        s.value(version);
+        s.value(count);
+
+        if (s.loading)
+        {
+            if (!s.ok || magic != CATALOG_MAGIC || version != CATALOG_VERSION)
+            {
+                s.ok = false;
+                return;
+            }
+            entries.clear();
+            entries.reserve(std::min<size_t>(count, s.size / 64));
+        }
+
+        for (uint32_t i = 0; i < count && s.ok; i++)
+        {
+            if (s.loading)
+                entries.emplace_back();
+            transfer(s, entries[i]);
+        }
+    }
+
+    // a missing or stale index just means hashing everything again
+    static std::vector<catalogEntry> readIndex(const char* path)
+    {
+        std::vector<catalogEntry> entries;
+
+        FILE* f = fopen(path, "rb");
+        if (!f)
+            return entries;
+
+        std::vector<uint8_t> data;
+        uint8_t chunk[64 * 1024];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+            data.insert(data.end(), chunk, chunk + n);
+        fclose(f);
+
+        emu::stream s = { data.data(), data.size(), 0, true, true };
+        transfer(s, entries);
+        if (!s.ok)
+            entries.clear();
+
+        return entries;
+    }
+
+    // written next to the index and renamed over it, an interrupted save leaves the old one intact
+    static bool writeIndex(const char* path, std::vector<catalogEntry>& entries)
+    {
+        emu::stream count = { nullptr, 0, 0, false, true };
+        transfer(count, entries);
+
+        std::vector<uint8_t> data(count.used);
+        emu::stream s = { data.data(), data.size(), 0, false, true };
+        transfer(s, entries);
+
+        const std::string temp = std::string(path) + ".tmp";
+        FILE* f = fopen(temp.c_str(), "wb");
+        if (!f)
+            return false;
+
+        bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+        ok = fclose(f) == 0 && ok;
+
+        std::error_code error;
+        if (ok)
+            fs::rename(temp, path, error);
+        if (!ok || error)
+        {
+            fs::remove(temp, error);
+            return false;
+        }
+        return true;
+    }
+
+    // open the file and fill in everything but path, size and mtime
+    static void hashOne(catalogEntry& e)
+    {
+        std::shared_ptr<const Image> image = load(e.path.c_str());
+
+        e.valid = image != nullptr;
+        e.info = {};
+        e.crc = e.prgCrc = 0;
+        e.hash = 0;
+
+        if (!image)
+            return;
+
+        e.info = image->info;
+
+        // CHR follows PRG in the file, one run covers both
+        const uint8_t* data = image->prg.data();
+        const size_t size = image->prg.size() + image->chr.size();
+
+        e.prgCrc = crc32(data, image->prg.size());
+        e.crc = image->chr.empty() ? e.prgCrc : crc32(image->chr.data(), image->chr.size(), e.prgCrc);
+        e.hash = xxh64(data, size);
+    }
+
+    catalog scanCatalog(const char* dir, const char* index, unsigned threads)
+    {
+        catalog c = {};
+
+        std::vector<catalogEntry> previous = readIndex(index);
+        std::unordered_map<std::string, size_t> known;
+        for (size_t i = 0; i < previous.size(); i++)
+            known[previous[i].path] = i;
+
+        // walk the tree, only stat() here, files are opened by the workers
+        std::vector<size_t> stale;
+        std::error_code error;
+
+        for (fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, error), end;
+            !error && it != end; it.increment(error))
+        {
+            std::string ext = it->path().extension().string();
+            std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char ch) { return (char)tolower(ch); });
+
+            std::error_code statError;
+            if (ext != ".nes" || !it->is_regular_file(statError))
+                continue;
+
+            catalogEntry e = {};
+            e.path = it->path().string();
+            e.size = it->file_size(statError);
+            e.mtime = static_cast<int64_t>(it->last_write_time(statError).time_since_epoch().count());
+            if (statError)
+                continue;
+
+            auto found = known.find(e.path);
+            if (found != known.end() && previous[found->second].size == e.size && previous[found->second].mtime == e.mtime)
+                c.entries.push_back(previous[found->second]);
+            else
+            {
+                stale.push_back(c.entries.size());
+                c.entries.push_back(e);
+            }
+        }
+
+        if (!threads)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        if (threads > stale.size())
+            threads = static_cast<unsigned>(std::max<size_t>(1, stale.size()));
+
+        // mostly I/O and similar sized files, a shared counter is enough
+        std::atomic<size_t> next(0);
+        auto worker = [&]
+        {
+            for (size_t i; (i = next.fetch_add(1)) < stale.size();)
+                hashOne(c.entries[stale[i]]);
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; i++)
+            pool.emplace_back(worker);
+        worker();
+        for (std::thread& t : pool)
+            t.join();
+
+        c.hashed = stale.size();
+
+        std::sort(c.entries.begin(), c.entries.end(),
+            [](const catalogEntry& a, const catalogEntry& b) { return a.path < b.path; });
+
+        // only touch the index when something was added, changed or removed
+        if (c.hashed || c.entries.size() != previous.size())
+            c.saved = writeIndex(index, c.entries);
+
+        return c;
+    }
+}
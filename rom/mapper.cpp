@@ -0,0 +1,348 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    mapper.cpp - cartridge bank switching (NROM, MMC1, UxROM, CNROM, MMC3)
+*/
+
+#include "../headers/rom/mapper.h"
+#include "../headers/mem/ram.h"
+#include "../headers/emu/system.h"
+#include "../headers/emu/state.h"
+
+namespace rom
+{
+    // CPU writes to 0x8000 - 0xFFFF land here
+    static void cartWrite(memory::Bus& bus, uint16_t addr, uint8_t data)
+    {
+        // bank switches and IRQ changes must not leak into scanlines the PPU hasn't drawn yet
+        bus.console->catchUp();
+        bus.console->mapper->write(addr, data);
+    }
+
+    void Mapper::setPrg(uint16_t addr, uint32_t size, int bank)
+    {
+        const size_t total = bus->prg.size();
+        const int banks = total >= size ? static_cast<int>(total / size) : 1;
+
+        // wrap around like the real hardware would with unconnected address lines
+        bank %= banks;
+        if (bank < 0)
+            bank += banks;
+
+        // carts smaller than the bank just get mirrored
+        size_t mirror = total < size ? total : size;
+        bus->mapRead(addr >> 8, size >> 8, bus->prg.data() + bank * mirror, mirror);
+    }
+
+    void Mapper::setChr(int slot, int count, int bank)
+    {
+        const size_t total = bus->chr.size();
+        const size_t bytes = count * 0x400;
+        const int banks = total >= bytes ? static_cast<int>(total / bytes) : 1;
+
+        bank %= banks;
+        if (bank < 0)
+            bank += banks;
+
+        for (int i = 0; i < count; i++)
+            chrBanks[slot + i] = bus->chr.data() + (bank * bytes + i * 0x400) % total;
+    }
+
+    // mapper 0, no bank switching at all
+    struct NROM : Mapper
+    {
+        void reset() override
+        {
+            setPrg(0x8000, 0x8000, 0);
+            setChr(0, 8, 0);
+        }
+    };
+
+    // mapper 1, serial shift register loaded one bit per write
+    struct MMC1 : Mapper
+    {
+        uint8_t shift;
+        uint8_t control;
+        uint8_t chr0;
+        uint8_t chr1;
+        uint8_t prgBank;
+
+        void reset() override
+        {
+            shift = 0x10;
+            control = 0x0C; // PRG mode 3, last bank fixed at 0xC000
+            chr0 = 0;
+            chr1 = 0;
+            prgBank = 0;
+            apply();
+        }
+
+        void write(uint16_t addr, uint8_t data) override
+        {
+            // bit 7 resets the shift register
+            if (data & 0x80)
+            {
+                shift = 0x10;
+                control |= 0x0C;
+                apply();
+                return;
+            }
+
+            // the marker bit reaching bit 0 means this is the fifth write
+            bool full = shift & 0x01;
+            shift = (shift >> 1) | ((data & 0x01) << 4);
+
+            if (!full)
+                return;
+
+            // register is picked by bits 13-14 of the address of the last write
+            switch ((addr >> 13) & 0x03)
+            {
+            case 0: control = shift; break;
+            case 1: chr0 = shift; break;
+            case 2: chr1 = shift; break;
+            case 3: prgBank = shift; break;
+            }
+
+            shift = 0x10;
+            apply();
+        }
+
+        void state(emu::stream& s) override
+        {
+            s.value(shift);
+            s.value(control);
+            s.value(chr0);
+            s.value(chr1);
+            s.value(prgBank);
+
+            if (s.loading)
+                apply();
+        }
+
+        void apply()
+        {
+            static const mirroring modes[4] = { SingleLow, SingleHigh, Vertical, Horizontal };
+            mirror = modes[control & 0x03];
+
+            int bank = prgBank & 0x0F;
+            switch ((control >> 2) & 0x03)
+            {
+            case 0:
+            case 1:
+                // 32kb mode, low bit ignored
+                setPrg(0x8000, 0x8000, bank >> 1);
+                break;
+            case 2:
+                setPrg(0x8000, 0x4000, 0);
+                setPrg(0xC000, 0x4000, bank);
+                break;
+            case 3:
+                setPrg(0x8000, 0x4000, bank);
+                setPrg(0xC000, 0x4000, -1);
+                break;
+            }
+
+            if (control & 0x10)
+            {
+                setChr(0, 4, chr0);
+                setChr(4, 4, chr1);
+            }
+            else
+                setChr(0, 8, chr0 >> 1);
+        }
+    };
+
+    // mapper 2, switchable 16kb at 0x8000, last bank fixed at 0xC000
+    struct UxROM : Mapper
+    {
+        uint8_t bank;
+
+        void reset() override
+        {
+            bank = 0;
+            setPrg(0x8000, 0x4000, 0);
+            setPrg(0xC000, 0x4000, -1);
+            setChr(0, 8, 0);
+        }
+
+        void write(uint16_t addr, uint8_t data) override
+        {
+            bank = data;
+            setPrg(0x8000, 0x4000, bank);
+        }
+
+        void state(emu::stream& s) override
+        {
+            s.value(bank);
+
+            if (s.loading)
+                setPrg(0x8000, 0x4000, bank);
+        }
+    };
+
+    // mapper 3, fixed PRG, switchable 8kb CHR
+    struct CNROM : Mapper
+    {
+        uint8_t bank;
+
+        void reset() override
+        {
+            bank = 0;
+            setPrg(0x8000, 0x8000, 0);
+            setChr(0, 8, 0);
+        }
+
+        void write(uint16_t addr, uint8_t data) override
+        {
+            bank = data;
+            setChr(0, 8, bank);
+        }
+
+        void state(emu::stream& s) override
+        {
+            s.value(bank);
+
+            if (s.loading)
+                setChr(0, 8, bank);
+        }
+    };
+
+    // mapper 4, 8kb PRG / 1-2kb CHR banks and a scanline IRQ counter
+    struct MMC3 : Mapper
+    {
+        uint8_t bankSelect;
+        uint8_t regs[8];
+        uint8_t irqLatch;
+        uint8_t irqCounter;
+        bool irqEnabled;
+        bool irqReload;
+
+        void reset() override
+        {
+            static const uint8_t initial[8] = { 0, 2, 4, 5, 6, 7, 0, 1 };
+            for (int i = 0; i < 8; i++)
+                regs[i] = initial[i];
+
+            bankSelect = 0;
+            irqLatch = 0;
+            irqCounter = 0;
+            irqEnabled = false;
+            irqReload = false;
+            apply();
+        }
+
+        void write(uint16_t addr, uint8_t data) override
+        {
+            bool even = !(addr & 0x01);
+
+            switch (addr & 0xE000)
+            {
+            case 0x8000:
+                if (even)
+                    bankSelect = data;
+                else
+                    regs[bankSelect & 0x07] = data;
+                apply();
+                break;
+            case 0xA000:
+                // odd writes are PRG RAM protect, which we don't enforce
+                if (even && mirror != FourScreen)
+                    mirror = (data & 0x01) ? Horizontal : Vertical;
+                break;
+            case 0xC000:
+                if (even)
+                    irqLatch = data;
+                else
+                    irqReload = true;
+                break;
+            case 0xE000:
+                irqEnabled = !even;
+                scanlineIrq = irqEnabled;
+                if (even)
+                    irq = false;
+                break;
+            }
+        }
+
+        void scanline() override
+        {
+            if (irqCounter == 0 || irqReload)
+            {
+                irqCounter = irqLatch;
+                irqReload = false;
+            }
+            else
+                irqCounter--;
+
+            if (irqCounter == 0 && irqEnabled)
+                irq = true;
+        }
+
+        void state(emu::stream& s) override
+        {
+            s.value(bankSelect);
+            s.bytes(regs, sizeof(regs));
+            s.value(irqLatch);
+            s.value(irqCounter);
+            s.value(irqEnabled);
+            s.value(irqReload);
+
+            if (s.loading)
+                apply();
+        }
+
+        void apply()
+        {
+            // bit 6 swaps which of 0x8000/0xC000 is fixed to the second to last bank
+            if (bankSelect & 0x40)
+            {
+                setPrg(0x8000, 0x2000, -2);
+                setPrg(0xC000, 0x2000, regs[6]);
+            }
+            else
+            {
+                setPrg(0x8000, 0x2000, regs[6]);
+                setPrg(0xC000, 0x2000, -2);
+            }
+            setPrg(0xA000, 0x2000, regs[7]);
+            setPrg(0xE000, 0x2000, -1);
+
+            // bit 7 swaps the 2kb and 1kb halves of CHR
+            int inv = (bankSelect & 0x80) ? 4 : 0;
+            setChr(0 ^ inv, 2, regs[0] >> 1);
+            setChr(2 ^ inv, 2, regs[1] >> 1);
+            setChr(4 ^ inv, 1, regs[2]);
+            setChr(5 ^ inv, 1, regs[3]);
+            setChr(6 ^ inv, 1, regs[4]);
+            setChr(7 ^ inv, 1, regs[5]);
+        }
+    };
+
+    Mapper* createMapper(int number)
+    {
+        switch (number)
+        {
+        case 0: return new NROM();
+        case 1: return new MMC1();
+        case 2: return new UxROM();
+        case 3: return new CNROM();
+        case 4: return new MMC3();
+        default: return nullptr;
+        }
+    }
+
+    void attach(emu::Console& console, Mapper* m)
+    {
+        delete console.mapper;
+        console.mapper = m;
+
+        m->bus = &console.bus;
+        m->irq = false;
+        m->scanlineIrq = false;
+        m->reset();
+
+        console.bus.mapWriteHandler(0x80, 0x80, cartWrite);
+    }
+}
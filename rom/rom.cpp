@@ -6,49 +6,228 @@
 // basic (bad) ROM loader (?)
 // uses the NES 2.0 format
 
-#include <iostream>
-#include <fstream>
+#include <algorithm>
 #include "../headers/rom/rom.h"
-#include "../headers/mem/ram.h"
-#include "../headers/gfx/ppu.h"
+#include "../headers/rom/mapper.h"
+#include "../headers/emu/system.h"
+#include "../headers/gfx/tiles.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace rom
 {
-    void testLoad()
+    // read-only mapping of a whole file, nullptr if it can't be opened or is empty
+    static const uint8_t* mapFile(const char* path, size_t& length)
     {
-        ROM rom;
-        std::ifstream file("I:\\Projects\\hobbies\\ernesto\\rom\\nestest2.nes", std::ios::binary);
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return nullptr;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0)
+        {
+            CloseHandle(file);
+            return nullptr;
+        }
 
-        rom.header.resize(16);
-        file.read(reinterpret_cast<char*>(rom.header.data()), 16); // load first 16 bytes of rom into the header
+        // the view keeps the mapping (and the file) alive after the handles are closed
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping)
+            return nullptr;
 
-        // implement checking for valid NES rom l8r (check for NES magic)
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!view)
+            return nullptr;
 
-        // prg size is stored in the 4th byte of the header
-        int prgSize = rom.header[4] * 16 * 1024;
-        int chrSize = rom.header[5] * 8 * 1024;
-        
-        // trainer section precedes PRG if 2nd bit of the 6th byte of the header is set
-        bool trainer = rom.header[6] & 0x04;
+        length = static_cast<size_t>(size.QuadPart);
+        return static_cast<const uint8_t*>(view);
+#else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return nullptr;
 
-        if (trainer)
+        struct stat st;
+        if (fstat(fd, &st) || st.st_size <= 0)
         {
-            rom.trainer.resize(512); // trainer sec always 512 bytes
-            file.read(reinterpret_cast<char*>(rom.trainer.data()), 512);
+            close(fd);
+            return nullptr;
         }
 
-        rom.prg.resize(prgSize);
-        file.read(reinterpret_cast<char*>(rom.prg.data()), prgSize);
+        void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (view == MAP_FAILED)
+            return nullptr;
 
-        if (chrSize > 0)
+        length = static_cast<size_t>(st.st_size);
+        return static_cast<const uint8_t*>(view);
+#endif
+    }
+
+    Image::~Image()
+    {
+        if (!base)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+#else
+        munmap(const_cast<uint8_t*>(base), length);
+#endif
+    }
+
+    // NES 2.0 ROM sizes, either a count of units or (when the high nibble is all ones) 2^E * (MM * 2 + 1)
+    static size_t romSize(uint8_t lsb, uint8_t msb, size_t unit)
+    {
+        if (msb == 0x0F)
         {
-            rom.chr.resize(chrSize);
-            file.read(reinterpret_cast<char*>(rom.chr.data()), chrSize);
+            const int exponent = lsb >> 2;
+            // nothing that big exists, make sure it fails the size check instead of overflowing
+            if (exponent > 40)
+                return SIZE_MAX / 2;
+            return (static_cast<size_t>(1) << exponent) * ((lsb & 0x03) * 2 + 1);
         }
+        return ((static_cast<size_t>(msb) << 8) | lsb) * unit;
+    }
 
-        // move PRG ROM into memory
-        memory::prg = rom.prg;
+    // NES 2.0 RAM sizes, 64 << shift, 0 means none
+    static size_t ramSize(uint8_t shift)
+    {
+        return shift ? static_cast<size_t>(64) << shift : 0;
+    }
+
+    bool parseHeader(const uint8_t* data, size_t size, header& h)
+    {
+        // "NES" followed by MS-DOS EOF
+        if (size < 16 || data[0] != 'N' || data[1] != 'E' || data[2] != 'S' || data[3] != 0x1A)
+            return false;
+
+        h = {};
+        h.nes2 = (data[7] & 0x0C) == 0x08;
+        h.vertical = data[6] & 0x01;
+        h.battery = data[6] & 0x02;
+        h.trainer = data[6] & 0x04; // trainer section precedes PRG if 2nd bit of the 6th byte of the header is set
+        h.fourScreen = data[6] & 0x08;
+
+        // mapper number is split in nibbles across bytes 6 and 7, NES 2.0 adds 4 more bits in byte 8
+        h.mapper = (data[6] >> 4) | (data[7] & 0xF0);
+
+        if (h.nes2)
+        {
+            h.mapper |= (data[8] & 0x0F) << 8;
+            h.submapper = data[8] >> 4;
+
+            // size MSBs live in byte 9, low nibble PRG, high nibble CHR
+            h.prgRom = romSize(data[4], data[9] & 0x0F, 16 * 1024);
+            h.chrRom = romSize(data[5], data[9] >> 4, 8 * 1024);
+            h.prgRam = ramSize(data[10] & 0x0F);
+            h.prgNvram = ramSize(data[10] >> 4);
+            h.chrRam = ramSize(data[11] & 0x0F);
+            h.chrNvram = ramSize(data[11] >> 4);
+            h.region = static_cast<timing>(data[12] & 0x03);
+        }
+        else
+        {
+            // old dumping tools wrote their name over bytes 7-15 ("DiskDude!"), only trust them when the tail is clean
+            const bool clean = !data[12] && !data[13] && !data[14] && !data[15];
+            if (!clean)
+                h.mapper &= 0x0F;
+
+            h.prgRom = data[4] * 16 * 1024;
+            h.chrRom = data[5] * 8 * 1024;
+
+            // byte 8 counts 8kb PRG RAM banks, 0 still means 8kb
+            const size_t prgRam = (clean && data[8] ? data[8] : 1) * 8 * 1024;
+            (h.battery ? h.prgNvram : h.prgRam) = prgRam;
+            h.chrRam = h.chrRom ? 0 : 8 * 1024;
+            h.region = clean && (data[9] & 0x01) ? PAL : NTSC;
+        }
+
+        // no PRG at all to map
+        return h.prgRom != 0;
+    }
+
+    std::shared_ptr<const Image> load(const char* path)
+    {
+        size_t length = 0;
+        const uint8_t* data = mapFile(path, length);
+        if (!data)
+            return nullptr;
+
+        // from here on the image owns the mapping, returning nullptr unmaps it
+        std::shared_ptr<Image> image = std::make_shared<Image>();
+        image->base = data;
+        image->length = length;
+
+        header& h = image->info;
+        if (!parseHeader(data, length, h))
+            return nullptr;
+
+        const size_t trainer = h.trainer ? 512 : 0; // trainer sec always 512 bytes
+
+        // truncated file
+        if (h.prgRom > length || h.chrRom > length || 16 + trainer + h.prgRom + h.chrRom > length)
+            return nullptr;
+
+        const uint8_t* at = data + 16;
+        image->trainer = { at, trainer };
+        at += trainer;
+        image->prg = { at, h.prgRom };
+        at += h.prgRom;
+        image->chr = { at, h.chrRom };
+
+        return image;
+    }
+
+    bool insert(emu::Console& console, std::shared_ptr<const Image> image)
+    {
+        const header& h = image->info;
+        memory::Bus& bus = console.bus;
+
+        // before touching the bus, a cart we can't run leaves the console as it was
+        Mapper* m = createMapper(h.mapper);
+        if (!m)
+            return false;
+
+        // PRG (and CHR ROM) stay in the mapping, carts without CHR ROM get CHR RAM, at least 8kb
+        bus.prg = image->prg;
+        if (image->chr.empty())
+        {
+            bus.chrRam.assign(std::max<size_t>(h.chrRam + h.chrNvram, 0x2000), 0);
+            bus.chr = { bus.chrRam.data(), bus.chrRam.size() };
+        }
+        else
+        {
+            bus.chrRam.clear();
+            bus.chr = image->chr;
+        }
+
+        // PRG RAM stays 8kb, none of the mappers we have bank it
+        bus.cartridge = std::move(image);
+        tiles::rebuild(bus.chr.data(), bus.chr.size(), console.ppu.decoded);
+
+        m->chrWritable = bus.chr.data() == bus.chrRam.data();
+        m->mirror = h.fourScreen ? FourScreen : h.vertical ? Vertical : Horizontal;
+        attach(console, m);
+        return true;
+    }
+
+    bool testLoad(emu::Console& console, const char* path)
+    {
+        std::shared_ptr<const Image> image = load(path);
+        if (!image)
+            return false;
 
-        file.close();
+        return insert(console, std::move(image));
     }
-}
\ No newline at end of file
+}
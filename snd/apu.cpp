@@ -0,0 +1,577 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    apu.cpp - 2A03 sound channels, frame counter and mixing
+*/
+
+#include "../headers/snd/apu.h"
+#include "../headers/emu/system.h"
+#include "../headers/emu/state.h"
+#include <algorithm>
+#include <cstring>
+
+namespace apu
+{
+    // length counter loads, indexed by the top 5 bits of the 4th register
+    static const uint8_t LENGTHS[32] =
+    {
+        10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+        12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+    };
+
+    static const uint8_t DUTY[4][8] =
+    {
+        { 0, 1, 0, 0, 0, 0, 0, 0 }, // 12.5%
+        { 0, 1, 1, 0, 0, 0, 0, 0 }, // 25%
+        { 0, 1, 1, 1, 1, 0, 0, 0 }, // 50%
+        { 1, 0, 0, 1, 1, 1, 1, 1 }  // 25% inverted
+    };
+
+    static const uint8_t TRIANGLE[32] =
+    {
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+    };
+
+    // NTSC, in CPU cycles
+    static const uint16_t NOISE_PERIODS[16] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+    static const uint16_t DMC_RATES[16] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+
+    // frame counter steps, CPU cycles after the sequence starts
+    static const uint32_t FOUR_STEP[4] = { 7457, 14913, 22371, 29829 };
+    static const uint32_t FIVE_STEP[5] = { 7457, 14913, 22371, 29829, 37281 };
+    static const uint32_t FOUR_STEP_PERIOD = 29830;
+    static const uint32_t FIVE_STEP_PERIOD = 37282;
+
+    // synthesis runs in chunks this long (about 4.6ms), each one ends up in the output ring
+    static const uint32_t FLUSH_CYCLES = 8192;
+
+    // full scale of the mixer in sample units, leaves headroom for the DC the high pass takes out
+    static const double AMPLITUDE = 24000.0;
+
+    // the 2A03's non linear mixer, as lookup tables
+    struct mixer
+    {
+        int pulse[31];
+        int tnd[203];
+
+        mixer()
+        {
+            pulse[0] = 0;
+            for (int n = 1; n < 31; n++)
+                pulse[n] = static_cast<int>(95.52 / (8128.0 / n + 100) * AMPLITUDE);
+
+            tnd[0] = 0;
+            for (int n = 1; n < 203; n++)
+                tnd[n] = static_cast<int>(163.67 / (24329.0 / n + 100) * AMPLITUDE);
+        }
+    };
+
+    static const mixer& levels()
+    {
+        static const mixer m;
+        return m;
+    }
+
+    static uint8_t volume(const envelope& e)
+    {
+        return e.constant ? e.volume : e.decay;
+    }
+
+    static int sweepTarget(const pulseChannel& p, int i)
+    {
+        const int change = p.timer >> p.sweepShift;
+        if (p.sweepNegate)
+            return p.timer - change - (i == 0 ? 1 : 0); // pulse 1 negates with ones' complement
+        return p.timer + change;
+    }
+
+    static bool pulseMuted(const pulseChannel& p, int i)
+    {
+        return p.timer < 8 || (!p.sweepNegate && sweepTarget(p, i) > 0x7FF);
+    }
+
+    static void clockEnvelope(envelope& e)
+    {
+        if (e.start)
+        {
+            e.start = false;
+            e.decay = 15;
+            e.divider = e.volume;
+        }
+        else if (e.divider == 0)
+        {
+            e.divider = e.volume;
+            if (e.decay > 0)
+                e.decay--;
+            else if (e.loop)
+                e.decay = 15;
+        }
+        else
+            e.divider--;
+    }
+
+    APU::APU()
+        : output(nullptr), console(nullptr), synth(4096), sampleRate(48000.0)
+    {
+        reset();
+    }
+
+    void APU::reset()
+    {
+        // memset rather than = {}, padding ends up in save states and rewind deltas
+        memset(pulse, 0, sizeof(pulse));
+        memset(&triangle, 0, sizeof(triangle));
+        memset(&noise, 0, sizeof(noise));
+        memset(&dmc, 0, sizeof(dmc));
+        memset(&frame, 0, sizeof(frame));
+
+        pulse[0].next = pulse[1].next = triangle.next = noise.next = dmc.next = IDLE;
+
+        noise.shift = 1;
+        dmc.bits = 8;
+        dmc.silence = true;
+        dmc.sampleAddress = 0xC000;
+        dmc.sampleLength = 1;
+
+        frame.next = FOUR_STEP[0];
+        time = 0;
+
+        resync();
+    }
+
+    void APU::resync()
+    {
+        synth.clear();
+        synthStart = time;
+
+        // the output is AC coupled anyway, starting from the current level avoids a click
+        amplitude = mix();
+    }
+
+    void APU::setRate(double rate)
+    {
+        sampleRate = rate;
+        synth.setRates(CPU_RATE, rate);
+        resync();
+    }
+
+    void APU::setRatio(double ratio)
+    {
+        // close the blip frame first, everything drawn so far keeps the rate it was drawn at
+        if (output)
+            flush();
+        synth.adjustRates(CPU_RATE, sampleRate * ratio);
+    }
+
+    void APU::writeRegister(uint16_t addr, uint8_t data)
+    {
+        if (addr < 0x4008)
+        {
+            pulseChannel& p = pulse[(addr >> 2) & 1];
+            switch (addr & 0x03)
+            {
+            case 0:
+                p.duty = data >> 6;
+                p.env.loop = data & 0x20;
+                p.env.constant = data & 0x10;
+                p.env.volume = data & 0x0F;
+                break;
+            case 1:
+                p.sweepEnabled = data & 0x80;
+                p.sweepPeriod = (data >> 4) & 0x07;
+                p.sweepNegate = data & 0x08;
+                p.sweepShift = data & 0x07;
+                p.sweepReload = true;
+                break;
+            case 2:
+                p.timer = (p.timer & 0x0700) | data;
+                break;
+            case 3:
+                p.timer = (p.timer & 0x00FF) | ((data & 0x07) << 8);
+                if (p.enabled)
+                    p.length = LENGTHS[data >> 3];
+                p.step = 0;
+                p.env.start = true;
+                break;
+            }
+        }
+        else switch (addr)
+        {
+        case 0x4008:
+            triangle.control = data & 0x80;
+            triangle.linearPeriod = data & 0x7F;
+            break;
+        case 0x400A:
+            triangle.timer = (triangle.timer & 0x0700) | data;
+            break;
+        case 0x400B:
+            triangle.timer = (triangle.timer & 0x00FF) | ((data & 0x07) << 8);
+            if (triangle.enabled)
+                triangle.length = LENGTHS[data >> 3];
+            triangle.linearReload = true;
+            break;
+        case 0x400C:
+            noise.env.loop = data & 0x20;
+            noise.env.constant = data & 0x10;
+            noise.env.volume = data & 0x0F;
+            break;
+        case 0x400E:
+            noise.mode = data & 0x80;
+            noise.period = data & 0x0F;
+            break;
+        case 0x400F:
+            if (noise.enabled)
+                noise.length = LENGTHS[data >> 3];
+            noise.env.start = true;
+            break;
+        case 0x4010:
+            dmc.irqEnabled = data & 0x80;
+            dmc.loop = data & 0x40;
+            dmc.rate = data & 0x0F;
+            if (!dmc.irqEnabled)
+                dmc.irq = false;
+            break;
+        case 0x4011:
+            dmc.output = data & 0x7F;
+            break;
+        case 0x4012:
+            dmc.sampleAddress = 0xC000 + data * 64;
+            break;
+        case 0x4013:
+            dmc.sampleLength = data * 16 + 1;
+            break;
+        case 0x4015:
+            pulse[0].enabled = data & 0x01;
+            pulse[1].enabled = data & 0x02;
+            triangle.enabled = data & 0x04;
+            noise.enabled = data & 0x08;
+
+            // disabling a channel silences it right away
+            if (!pulse[0].enabled)
+                pulse[0].length = 0;
+            if (!pulse[1].enabled)
+                pulse[1].length = 0;
+            if (!triangle.enabled)
+                triangle.length = 0;
+            if (!noise.enabled)
+                noise.length = 0;
+
+            dmc.irq = false;
+            if (!(data & 0x10))
+                dmc.remaining = 0;
+            else if (!dmc.remaining)
+            {
+                dmc.address = dmc.sampleAddress;
+                dmc.remaining = dmc.sampleLength;
+                fetchSample();
+            }
+            break;
+        case 0x4017:
+            // the sequence restarts, 5 step mode clocks everything once straight away
+            frame.fiveStep = data & 0x80;
+            frame.inhibit = data & 0x40;
+            if (frame.inhibit)
+                frame.irq = false;
+
+            frame.step = 0;
+            frame.start = time;
+            frame.next = time + FOUR_STEP[0];
+
+            if (frame.fiveStep)
+            {
+                quarterFrame();
+                halfFrame();
+            }
+            break;
+        }
+
+        schedule();
+        updateOutput();
+    }
+
+    uint8_t APU::readStatus()
+    {
+        uint8_t status = (pulse[0].length ? 0x01 : 0) |
+            (pulse[1].length ? 0x02 : 0) |
+            (triangle.length ? 0x04 : 0) |
+            (noise.length ? 0x08 : 0) |
+            (dmc.remaining ? 0x10 : 0) |
+            (frame.irq ? 0x40 : 0) |
+            (dmc.irq ? 0x80 : 0);
+
+        // reading acknowledges the frame IRQ
+        frame.irq = false;
+        return status;
+    }
+
+    void APU::quarterFrame()
+    {
+        clockEnvelope(pulse[0].env);
+        clockEnvelope(pulse[1].env);
+        clockEnvelope(noise.env);
+
+        if (triangle.linearReload)
+            triangle.linear = triangle.linearPeriod;
+        else if (triangle.linear)
+            triangle.linear--;
+        if (!triangle.control)
+            triangle.linearReload = false;
+    }
+
+    void APU::halfFrame()
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            pulseChannel& p = pulse[i];
+
+            if (!p.env.loop && p.length)
+                p.length--;
+
+            if (p.sweepDivider == 0 && p.sweepEnabled && p.sweepShift && !pulseMuted(p, i))
+                p.timer = static_cast<uint16_t>(std::max(0, sweepTarget(p, i)));
+
+            if (p.sweepDivider == 0 || p.sweepReload)
+            {
+                p.sweepDivider = p.sweepPeriod;
+                p.sweepReload = false;
+            }
+            else
+                p.sweepDivider--;
+        }
+
+        if (!triangle.control && triangle.length)
+            triangle.length--;
+        if (!noise.env.loop && noise.length)
+            noise.length--;
+    }
+
+    void APU::frameStep()
+    {
+        if (!frame.fiveStep)
+        {
+            quarterFrame();
+            if (frame.step == 1 || frame.step == 3)
+                halfFrame();
+            if (frame.step == 3 && !frame.inhibit)
+                frame.irq = true;
+        }
+        else
+        {
+            // the 4th step of the 5 step sequence does nothing
+            if (frame.step != 3)
+                quarterFrame();
+            if (frame.step == 1 || frame.step == 4)
+                halfFrame();
+        }
+
+        const int steps = frame.fiveStep ? 5 : 4;
+        if (++frame.step == steps)
+        {
+            frame.step = 0;
+            frame.start += frame.fiveStep ? FIVE_STEP_PERIOD : FOUR_STEP_PERIOD;
+        }
+
+        frame.next = frame.start + (frame.fiveStep ? FIVE_STEP[frame.step] : FOUR_STEP[frame.step]);
+    }
+
+    void APU::clockPulse(int i)
+    {
+        pulseChannel& p = pulse[i];
+        p.step = (p.step + 1) & 0x07;
+        p.next += (p.timer + 1) * 2;
+    }
+
+    void APU::clockTriangle()
+    {
+        triangle.step = (triangle.step + 1) & 0x1F;
+        triangle.next += triangle.timer + 1;
+    }
+
+    void APU::clockNoise()
+    {
+        const uint16_t feedback = (noise.shift ^ (noise.shift >> (noise.mode ? 6 : 1))) & 0x01;
+        noise.shift = (noise.shift >> 1) | (feedback << 14);
+        noise.next += NOISE_PERIODS[noise.period];
+    }
+
+    void APU::clockDmc()
+    {
+        if (!dmc.silence)
+        {
+            if (dmc.shift & 0x01)
+            {
+                if (dmc.output <= 125)
+                    dmc.output += 2;
+            }
+            else if (dmc.output >= 2)
+                dmc.output -= 2;
+        }
+        dmc.shift >>= 1;
+
+        if (--dmc.bits == 0)
+        {
+            dmc.bits = 8;
+            dmc.silence = !dmc.bufferFull;
+            if (dmc.bufferFull)
+            {
+                dmc.shift = dmc.buffer;
+                dmc.bufferFull = false;
+                fetchSample();
+            }
+        }
+
+        dmc.next += DMC_RATES[dmc.rate];
+    }
+
+    // the CPU stall of the sample fetch isn't emulated
+    void APU::fetchSample()
+    {
+        if (dmc.bufferFull || !dmc.remaining)
+            return;
+
+        // samples live in PRG, read through the page table so nothing with side effects runs
+        const uint8_t* page = console ? console->bus.readPages[dmc.address >> 8] : nullptr;
+        dmc.buffer = page ? page[dmc.address & 0xFF] : 0;
+        dmc.bufferFull = true;
+
+        dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+        if (--dmc.remaining == 0)
+        {
+            if (dmc.loop)
+            {
+                dmc.address = dmc.sampleAddress;
+                dmc.remaining = dmc.sampleLength;
+            }
+            else if (dmc.irqEnabled)
+                dmc.irq = true;
+        }
+    }
+
+    // start timers for channels that became audible, stop the ones that went quiet
+    // a channel nobody can hear has no phase worth keeping, so it isn't clocked at all
+    void APU::schedule()
+    {
+        auto arm = [this](uint64_t& next, bool active, uint32_t period)
+        {
+            if (!active)
+                next = IDLE;
+            else if (next == IDLE)
+                next = time + period;
+        };
+
+        for (int i = 0; i < 2; i++)
+            arm(pulse[i].next, pulse[i].length && !pulseMuted(pulse[i], i), (pulse[i].timer + 1) * 2);
+
+        // ultrasonic periods freeze the triangle instead of aliasing
+        arm(triangle.next, triangle.length && triangle.linear && triangle.timer >= 2, triangle.timer + 1);
+        arm(noise.next, noise.length != 0, NOISE_PERIODS[noise.period]);
+        arm(dmc.next, dmc.remaining || dmc.bufferFull || !dmc.silence, DMC_RATES[dmc.rate]);
+    }
+
+    int APU::mix() const
+    {
+        int p = 0;
+        for (int i = 0; i < 2; i++)
+        {
+            const pulseChannel& c = pulse[i];
+            if (c.length && !pulseMuted(c, i) && DUTY[c.duty][c.step])
+                p += volume(c.env);
+        }
+
+        const int t = TRIANGLE[triangle.step];
+        const int n = noise.length && !(noise.shift & 0x01) ? volume(noise.env) : 0;
+
+        const mixer& m = levels();
+        return m.pulse[p] + m.tnd[3 * t + 2 * n + dmc.output];
+    }
+
+    void APU::updateOutput()
+    {
+        if (!output)
+            return;
+
+        const int a = mix();
+        if (a != amplitude)
+        {
+            synth.addDelta(static_cast<uint32_t>(time - synthStart), a - amplitude);
+            amplitude = a;
+        }
+    }
+
+    void APU::flush()
+    {
+        synth.endFrame(static_cast<uint32_t>(time - synthStart));
+        synthStart = time;
+
+        // a full ring drops samples, the emulation never waits on audio
+        int16_t samples[512];
+        size_t n;
+        while ((n = synth.read(samples, 512)) > 0)
+            output->push(samples, n);
+    }
+
+    void APU::run(uint64_t to)
+    {
+        while (time < to)
+        {
+            // jump straight to the next thing that happens
+            uint64_t next = std::min(to, frame.next);
+            next = std::min(next, std::min(pulse[0].next, pulse[1].next));
+            next = std::min(next, std::min(triangle.next, std::min(noise.next, dmc.next)));
+            if (output)
+                next = std::min(next, synthStart + FLUSH_CYCLES);
+
+            time = next;
+
+            if (pulse[0].next == time)
+                clockPulse(0);
+            if (pulse[1].next == time)
+                clockPulse(1);
+            if (triangle.next == time)
+                clockTriangle();
+            if (noise.next == time)
+                clockNoise();
+            if (dmc.next == time)
+                clockDmc();
+            if (frame.next == time)
+                frameStep();
+
+            schedule();
+            updateOutput();
+
+            if (output && time - synthStart >= FLUSH_CYCLES)
+                flush();
+        }
+
+        // nothing to synthesize, keep the frame start current for when an output shows up
+        if (!output)
+            synthStart = time;
+    }
+
+    uint64_t APU::nextIrq() const
+    {
+        uint64_t at = IDLE;
+
+        // the 4 step sequence raises it on its last step
+        if (!frame.fiveStep && !frame.inhibit && !frame.irq)
+            at = frame.start + FOUR_STEP[3];
+
+        // the DMC raises it on the fetch that empties the sample, which happens on one of its clocks
+        if (dmc.irqEnabled && !dmc.loop && !dmc.irq && dmc.remaining)
+            at = std::min(at, dmc.next);
+
+        return at;
+    }
+
+    void APU::state(emu::stream& s)
+    {
+        s.value(pulse);
+        s.value(triangle);
+        s.value(noise);
+        s.value(dmc);
+        s.value(frame);
+        s.value(time);
+    }
+}
@@ -0,0 +1,144 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    blip.cpp - band-limited steps into a sample buffer
+*/
+
+#include "../headers/snd/blip.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace apu
+{
+    // taps per step, and how finely a step's position between two samples is resolved
+    static const int WIDTH = 16;
+    static const int PHASE_BITS = 6;
+    static const int PHASES = 1 << PHASE_BITS;
+
+    // every kernel sums to exactly 1 << UNITY_BITS, so the integrated output never drifts
+    static const int UNITY_BITS = 15;
+
+    // the integrator leaks a little every sample, which removes DC (about 15hz at 48khz)
+    static const int HIGH_PASS = 9;
+
+    static const double PI = 3.14159265358979323846;
+
+    struct kernels
+    {
+        int32_t taps[PHASES][WIDTH];
+
+        kernels()
+        {
+            // low pass just under nyquist, blackman windowed
+            const double cutoff = 0.45;
+
+            for (int p = 0; p < PHASES; p++)
+            {
+                double shape[WIDTH];
+                double total = 0;
+
+                for (int k = 0; k < WIDTH; k++)
+                {
+                    // distance from the step, which sits WIDTH / 2 samples in plus the phase
+                    const double x = k - WIDTH / 2 - static_cast<double>(p) / PHASES;
+                    const double y = 2 * cutoff * x;
+                    const double sinc = y == 0 ? 1 : sin(PI * y) / (PI * y);
+                    const double window = fabs(x) >= WIDTH / 2 ? 0 :
+                        0.42 + 0.5 * cos(2 * PI * x / WIDTH) + 0.08 * cos(4 * PI * x / WIDTH);
+
+                    shape[k] = sinc * window;
+                    total += shape[k];
+                }
+
+                // scale to unity, rounding error goes on the biggest tap
+                int32_t sum = 0;
+                int biggest = 0;
+                for (int k = 0; k < WIDTH; k++)
+                {
+                    taps[p][k] = static_cast<int32_t>(lround(shape[k] / total * (1 << UNITY_BITS)));
+                    sum += taps[p][k];
+                    if (taps[p][k] > taps[p][biggest])
+                        biggest = k;
+                }
+                taps[p][biggest] += (1 << UNITY_BITS) - sum;
+            }
+        }
+    };
+
+    static const kernels& kernel()
+    {
+        static const kernels k;
+        return k;
+    }
+
+    blip::blip(size_t capacity)
+        : buffer(capacity + WIDTH + 1), factor(0), offset(0), ready(0), sum(0)
+    {
+        setRates(1789773.0, 48000.0);
+    }
+
+    void blip::setRates(double clockRate, double sampleRate)
+    {
+        adjustRates(clockRate, sampleRate);
+        clear();
+    }
+
+    void blip::adjustRates(double clockRate, double sampleRate)
+    {
+        factor = static_cast<uint64_t>(sampleRate / clockRate * 4294967296.0 + 0.5);
+    }
+
+    void blip::clear()
+    {
+        std::fill(buffer.begin(), buffer.end(), 0);
+        offset = 0;
+        ready = 0;
+        sum = 0;
+    }
+
+    void blip::addDelta(uint32_t time, int delta)
+    {
+        const uint64_t fixed = offset + time * factor;
+        const size_t index = static_cast<size_t>(fixed >> 32);
+        const int phase = static_cast<int>(fixed >> (32 - PHASE_BITS)) & (PHASES - 1);
+
+        // frames longer than the buffer lose their tail rather than write past it
+        if (index + WIDTH > buffer.size())
+            return;
+
+        const int32_t* taps = kernel().taps[phase];
+        int32_t* out = &buffer[index];
+        for (int k = 0; k < WIDTH; k++)
+            out[k] += taps[k] * delta;
+    }
+
+    void blip::endFrame(uint32_t clocks)
+    {
+        offset += clocks * factor;
+        ready = std::min(static_cast<size_t>(offset >> 32), buffer.size() - WIDTH - 1);
+    }
+
+    size_t blip::read(int16_t* out, size_t count)
+    {
+        const size_t n = std::min(count, ready);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            sum += buffer[i];
+            const int64_t s = sum >> UNITY_BITS;
+            out[i] = static_cast<int16_t>(s < -32768 ? -32768 : s > 32767 ? 32767 : s);
+            sum -= sum >> HIGH_PASS;
+        }
+
+        // only the steps still being drawn (up to WIDTH past the frame start) are non zero past ready
+        const size_t used = ready + WIDTH + 1;
+        memmove(buffer.data(), buffer.data() + n, (used - n) * sizeof(int32_t));
+        std::fill(buffer.begin() + (used - n), buffer.begin() + used, 0);
+
+        offset -= static_cast<uint64_t>(n) << 32;
+        ready -= n;
+        return n;
+    }
+}
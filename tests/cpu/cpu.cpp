@@ -1,9 +1,16 @@
 #include "pch.h"
 #include "CppUnitTest.h"
-#include "../../headers/mem/ram.h"
-#include "../../headers/cpu/cpu.h"
+#include "../../headers/emu/system.h"
 #include "../../cpu/cpu.cpp"
 #include "../../mem/ram.cpp"
+#include "../../gfx/ppu.cpp"
+#include "../../gfx/tiles.cpp"
+#include "../../snd/apu.cpp"
+#include "../../snd/blip.cpp"
+#include "../../rom/mapper.cpp"
+#include "../../emu/system.cpp"
+#include "../../emu/state.cpp"
+#include "../../emu/debugger.cpp"
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
@@ -16,14 +23,16 @@ namespace cpuTest
 		TEST_METHOD(cpuTest01)
 		{
 			// Test some instructions
-			memory::initialize();
+			emu::Console* console = new emu::Console();
 			
 			// Fill up memory with 0x01
-			for (int i = 0; i < memory::ram.size(); i++)
+			for (int i = 0; i < console->bus.internal.size(); i++)
 			{
-				memory::write((uint16_t)i, 0x01);
+				console->bus.write((uint16_t)i, 0x01);
 			}
 
+			delete console;
+
 			printf("Memory filled");
 		}
 	};
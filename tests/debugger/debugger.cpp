@@ -0,0 +1,206 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    debugger.cpp - condition compiler and stepping checks, no SDL/ImGui, no ROM needed
+*/
+
+// usage: debugger
+// conditions are evaluated against a bare console, stepping runs a small recursive program out of internal RAM
+// exits 0 when every check passes, 1 otherwise
+
+#include "../../headers/emu/debugger.h"
+#include "../../headers/emu/system.h"
+#include <cstdio>
+#include <string>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok)
+    {
+        printf("[ernesto] - failed: %s\n", what);
+        failures++;
+    }
+}
+
+// compile text and evaluate it for an access to addr, -1000 when it doesn't compile
+static int64_t evaluate(const emu::Console& console, const char* text, uint16_t addr = 0, uint8_t value = 0)
+{
+    emu::condition c;
+    std::string error;
+    if (!c.compile(text, error))
+        return -1000;
+    return c.evaluate(console, addr, value);
+}
+
+static bool compiles(const char* text)
+{
+    emu::condition c;
+    std::string error;
+    return c.compile(text, error);
+}
+
+// the frontend's loop: ask the debugger before every instruction, false if it never stops
+static bool run(emu::Console& console, emu::Debugger& debugger, int limit = 100000)
+{
+    for (int i = 0; i < limit; i++)
+    {
+        if (debugger.armed && debugger.beforeInstruction())
+            return true;
+        if (!emu::step(console))
+            return false;
+    }
+    return false;
+}
+
+static void conditions(emu::Console& console)
+{
+    cpu::CPU& c = console.cpu;
+
+    // precedence, C's order
+    check(evaluate(console, "1 + 2 * 3") == 7, "* before +");
+    check(evaluate(console, "(1 + 2) * 3") == 9, "parentheses");
+    check(evaluate(console, "8 - 2 - 1") == 5, "- is left associative");
+    check(evaluate(console, "16 / 4 / 2") == 2, "/ is left associative");
+    check(evaluate(console, "7 % 4 + 1") == 4, "% before +");
+    check(evaluate(console, "2 + 3 == 5") == 1, "+ before ==");
+    check(evaluate(console, "1 < 2 == 1") == 1, "< before ==");
+    check(evaluate(console, "1 | 2 == 2") == 1, "== before |");
+    check(evaluate(console, "6 & 3 ^ 1") == 3, "& before ^");
+    check(evaluate(console, "4 ^ 1 | 2") == 7, "^ before |");
+    check(evaluate(console, "0 && 1 || 1") == 1, "&& before ||");
+    check(evaluate(console, "1 || 0 && 0") == 1, "|| last");
+    check(evaluate(console, "-2 * 3") == -6, "unary minus");
+    check(evaluate(console, "!0 + 1") == 2, "! before +");
+    check(evaluate(console, "~0 & $FF") == 0xFF, "~ and hex");
+    check(evaluate(console, "0x10 + 10") == 26, "0x and decimal");
+    check(evaluate(console, "1 != 2") == 1, "!= isn't !");
+    check(evaluate(console, "5 / 0") == 0, "division by zero");
+
+    // registers and the access
+    c.A = 0x10;
+    c.X = 0x01;
+    check(evaluate(console, "a == $10 && x == 1") == 1, "registers");
+    check(evaluate(console, "addr == $2000 && value == $80", 0x2000, 0x80) == 1, "the access");
+
+    // [address] is a byte of memory, the address can be any expression
+    console.bus.write(0x0300, 0x05);
+    console.bus.write(0x0301, 0x42);
+    console.bus.write(0x0010, 0x01);
+    console.bus.write(0x0001, 0x99);
+    check(evaluate(console, "[$0300]") == 0x05, "dereference");
+    check(evaluate(console, "[$0300 + x]") == 0x42, "dereference of an expression");
+    check(evaluate(console, "[[$0010]]") == 0x99, "nested dereference");
+    check(evaluate(console, "[$0300] * 2 + 1") == 11, "dereference is a primary");
+    check(evaluate(console, "a == $10 && [$0300] != 0") == 1, "registers and memory together");
+
+    // an empty condition always holds, broken ones don't compile
+    check(evaluate(console, "  ") == 1, "empty is true");
+    check(!compiles("1 +"), "missing operand");
+    check(!compiles("(1 + 2"), "missing )");
+    check(!compiles("[$0300"), "missing ]");
+    check(!compiles("foo == 1"), "unknown name");
+    check(!compiles("1 2"), "trailing text");
+}
+
+// stepping over a JSR that calls itself: the inner calls return through the same address on a deeper stack
+static void stepping(emu::Console& console)
+{
+    static const uint8_t program[] =
+    {
+        0xA2, 0x03,       // 0200 LDX #$03
+        0x20, 0x10, 0x02, // 0202 JSR $0210
+        0xEA,             // 0205 NOP
+        0x4C, 0x06, 0x02, // 0206 JMP $0206
+    };
+    static const uint8_t recurse[] =
+    {
+        0xCA,             // 0210 DEX
+        0xF0, 0x03,       // 0211 BEQ $0216
+        0x20, 0x10, 0x02, // 0213 JSR $0210
+        0x60,             // 0216 RTS
+    };
+
+    for (size_t i = 0; i < sizeof(program); i++)
+        console.bus.write(static_cast<uint16_t>(0x0200 + i), program[i]);
+    for (size_t i = 0; i < sizeof(recurse); i++)
+        console.bus.write(static_cast<uint16_t>(0x0210 + i), recurse[i]);
+
+    cpu::CPU& c = console.cpu;
+    emu::Debugger debugger;
+    debugger.attach(console);
+    std::string error;
+
+    // over the outer call, the whole recursion runs
+    c.PC = 0x0200;
+    c.SP = 0xFD;
+    emu::step(console);
+    debugger.stepOver();
+    debugger.resume();
+    check(run(console, debugger) && debugger.reason == emu::StepDone, "step over stops");
+    check(c.PC == 0x0205 && c.SP == 0xFD && c.X == 0, "step over the outer call");
+
+    // over the recursive call from the first level, deeper returns to 0216 don't count
+    c.PC = 0x0200;
+    c.SP = 0xFD;
+    debugger.add(0x0213, 0x0213, emu::Exec, "", error);
+    check(run(console, debugger) && c.PC == 0x0213 && c.X == 2, "exec breakpoint in the first level");
+
+    const uint8_t level = c.SP;
+    debugger.clear();
+    debugger.stepOver();
+    debugger.resume();
+    check(run(console, debugger) && debugger.reason == emu::StepDone, "recursive step over stops");
+    check(c.PC == 0x0216 && c.SP == level && c.X == 0, "step over the recursive call");
+
+    // out of the first level, back to the outer caller
+    debugger.stepOut();
+    debugger.resume();
+    check(run(console, debugger) && debugger.reason == emu::StepDone, "step out stops");
+    check(c.PC == 0x0205 && c.SP == 0xFD, "step out");
+
+    // a breakpoint inside the call ends the step over, continuing runs free instead of stopping at 0205
+    c.PC = 0x0200;
+    c.SP = 0xFD;
+    emu::step(console);
+    debugger.add(0x0216, 0x0216, emu::Exec, "", error);
+    debugger.stepOver();
+    debugger.resume();
+    check(run(console, debugger) && debugger.reason == emu::Breakpoint && c.PC == 0x0216, "breakpoint during step over");
+
+    debugger.clear();
+    debugger.resume();
+    check(!run(console, debugger, 1000) && !debugger.armed, "step over ends at a breakpoint");
+
+    // same for a watchpoint during step out
+    c.PC = 0x0200;
+    c.SP = 0xFD;
+    debugger.add(0x0213, 0x0213, emu::Exec, "", error);
+    run(console, debugger);
+    debugger.clear();
+    debugger.add(0x01F0, 0x01FF, emu::Write, "", error);
+    debugger.stepOut();
+    debugger.resume();
+    check(run(console, debugger) && debugger.reason == emu::Breakpoint && debugger.hitAccess == emu::Write, "watchpoint during step out");
+
+    debugger.clear();
+    debugger.resume();
+    check(!run(console, debugger, 1000) && !debugger.armed, "step out ends at a watchpoint");
+
+    debugger.detach();
+}
+
+int main()
+{
+    emu::Console* console = new emu::Console();
+
+    conditions(*console);
+    stepping(*console);
+
+    printf("[ernesto] - debugger %s, %d failures\n", failures ? "failed" : "passed", failures);
+
+    delete console;
+    return failures ? 1 : 0;
+}
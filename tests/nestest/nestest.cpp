@@ -0,0 +1,92 @@
+/*
+    ernesto - 6502, ergo NES emulator
+    author: Iago Maldonado (@iagoMAO)
+
+    nestest.cpp - nestest regression check, no SDL/ImGui, runs anywhere the core builds
+*/
+
+// usage: nestest [--rom rom/nestest.nes] [--golden rom/nestest-baseline.log] [--lines n] [--registers] [--context n]
+// rom/nestest-baseline.log was recorded from ernesto itself in the format of Nintendulator's nestest.log, it
+// catches changes in behaviour, not bugs that were already there. the only independent check is nestest's own
+// error codes at $10/$11. pass Nintendulator's log with --golden to compare against it instead. --lines is
+// for bisecting a divergence by hand, a run that stops early never counts as a pass for the error codes
+// exits 0 when every line matches and nestest reports no errors, 1 otherwise (a missing ROM or log included)
+
+#include "../../headers/emu/nestest.h"
+#include "../../headers/emu/system.h"
+#include "../../headers/rom/rom.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+
+static bool readFile(const char* path, std::vector<char>& data)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return false;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    data.resize(size > 0 ? size : 0);
+    bool ok = fread(data.data(), 1, data.size(), f) == data.size();
+    fclose(f);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    const char* romPath = "rom/nestest.nes";
+    const char* goldenPath = "rom/nestest-baseline.log";
+    emu::nestestOptions o = {};
+    o.context = 5;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+
+        if (!strcmp(argv[i], "--rom") && hasValue)
+            romPath = argv[++i];
+        else if (!strcmp(argv[i], "--golden") && hasValue)
+            goldenPath = argv[++i];
+        else if (!strcmp(argv[i], "--lines") && hasValue)
+            o.lines = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--context") && hasValue)
+            o.context = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--registers"))
+            o.registers = true;
+        else
+        {
+            printf("usage: nestest [--rom path] [--golden path] [--lines n] [--registers] [--context n]\n");
+            return -1;
+        }
+    }
+
+    // the whole log in one buffer, lines are compared in place
+    std::vector<char> golden;
+    if (!readFile(goldenPath, golden))
+    {
+        printf("[ernesto] - no golden log at %s\n", goldenPath);
+        return 1;
+    }
+
+    emu::Console* console = new emu::Console();
+    if (!rom::testLoad(*console, romPath))
+    {
+        printf("[ernesto] - couldn't load %s\n", romPath);
+        delete console;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    emu::nestestResult r = emu::runNestest(*console, golden.data(), golden.size(), o, stdout);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[ernesto] - nestest %s, %zu lines matched in %.2fms\n", r.passed ? "passed" : "failed", r.lines, ms);
+
+    delete console;
+    return r.passed ? 0 : 1;
+}